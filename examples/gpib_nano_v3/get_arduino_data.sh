@@ -3,8 +3,10 @@
 # --- Configuration ---
 # The serial device file.
 DEVICE="/dev/ttyUSB0"
+# The baud rate must match the sketch (up to 2000000 with GPIB_FAST_SERIAL).
+BAUD="115200"
 # The baud rate and other settings for the serial port.
-STTY_SETTINGS="115200 cs8 -cstopb -parenb raw -echo"
+STTY_SETTINGS="$BAUD cs8 -cstopb -parenb raw -echo"
 # The command string to send to the device. The script adds the newline.
 COMMAND_STRING="*init 22,*write F5T3,*listen"
 
@@ -9,27 +9,57 @@
   All commands must begin with a '*' and be terminated with a newline (Enter) or comma (,).
 
   ** Protocol Commands **
-  - *INIT <addr>: Sends an Interface Clear (IFC), enables remote control (REN),
-    and sends UNLISTEN and UNTALK commands.
+  - *INIT <addr> [secondary]: Sends an Interface Clear (IFC), enables remote control (REN),
+    and sends UNLISTEN and UNTALK commands. The optional secondary address (0-30,
+    or 96-126) selects a channel of a multi-channel instrument or switch mainframe.
+  - *ADDR <addr> [secondary]: Changes the target device without another IFC.
+    Only the addressing bytes that change are sent on the next *WRITE or *LISTEN.
   - *WRITE <string>: Sends a string to the bus, asserting EOI on the last character.
     including setting the talker and listener.
-  - *LISTEN: Configures the bus by commanding the previously initialized device
+  - *LISTEN [count]: Configures the bus by commanding the previously initialized device
     to TALK, then puts the controller into a listening state to receive a data
     string. The operation completes when EOI is detected or after a timeout.
+    With a count, that many readings are taken back to back.
+
+  ** Reduction Commands **
+  - *REDUCE NONE|AVG <n>|STATS <n>: Parse readings as numbers and report the
+    average (AVG) or mean,min,max,std (STATS) of every n readings.
+  - *FORMAT ASCII|BINARY: Report numeric results as text or as packed
+    little-endian 4 byte floats, framed as "#<digits><length><floats>" blocks
+    of up to 15 floats per *LISTEN.
+
+  ** Scan List Commands **
+  - *SCAN ADD <addr> [secondary]: Add an instrument to the scan list.
+  - *SCAN QUERY <string>, EOS <0-255>|NONE, TMO <ms>: Set up the entry added last.
+  - *SCAN CLEAR|LIST|SAVE|LOAD: Edit the list, or keep it in EEPROM.
+  - *SCAN RUN [cycles]|LOOP: Print one "SCAN <n>;<addr> <ms> <reading>;..." row
+    per pass over the list. LOOP runs until the next serial input.
+
+  ** Device Mode Commands **
+  - *DEVICE <addr> [secondary]|OFF: Emulate an instrument at <addr> for another controller.
+  - *PATTERN COUNT|<string>: What the emulated instrument talks and expects.
+  - *STATUS: Print device mode message and error counts.
 */
 
-// Include the library with helper functions and pin definitions
+// Include the library with helper functions and pin definitions.
+// GPIB_SERIAL is Serial, or the faster FastSerial backend if GPIB_FAST_SERIAL
+// is enabled in GPIBnano.h.
 
 #include <GPIBnano.h>
 
 void setup() {
-  Serial.begin(115200);
+  GPIB_SERIAL.begin(115200); // with GPIB_FAST_SERIAL, up to 2000000 (match BAUD in the script)
   gpibNano.begin();
 }
 
 void loop() {
   gpibNano.processGPIB();
   if(gpibNano.isResult()){
-    Serial.println(gpibNano.result());
+    if (gpibNano.isBinaryResult()) {
+      uint8_t length = gpibNano.resultLength();
+      GPIB_SERIAL.write((const uint8_t*)gpibNano.result(), length);
+    } else {
+      GPIB_SERIAL.println(gpibNano.result());
+    }
   }
 }
@@ -0,0 +1,194 @@
+#include "GPIBnano.h" // GPIB_FAST_SERIAL and the fast pin macros
+#ifdef GPIB_FAST_SERIAL
+#include <avr/interrupt.h>
+
+#define RX_MASK (FAST_SERIAL_RX_BUFFER_SIZE - 1)
+#define TX_MASK (FAST_SERIAL_TX_BUFFER_SIZE - 1)
+
+#if (FAST_SERIAL_RX_BUFFER_SIZE & RX_MASK) || FAST_SERIAL_RX_BUFFER_SIZE > 256
+#error "FAST_SERIAL_RX_BUFFER_SIZE must be a power of two no larger than 256"
+#endif
+#if (FAST_SERIAL_TX_BUFFER_SIZE & TX_MASK) || FAST_SERIAL_TX_BUFFER_SIZE > 256
+#error "FAST_SERIAL_TX_BUFFER_SIZE must be a power of two no larger than 256"
+#endif
+
+#ifdef FAST_SERIAL_FLOW_CONTROL
+#if FAST_SERIAL_CTS_PIN < 14 || FAST_SERIAL_CTS_PIN > 19
+#error "FAST_SERIAL_CTS_PIN must be A0-A5 (port C pin change interrupt)"
+#endif
+#define ctsAsserted() (digitalReadFast(FAST_SERIAL_CTS_PIN) == LOW)
+#else
+#define ctsAsserted() (true)
+#endif
+
+// Clear TXC0 (by writing a 1) without disturbing the mode bits, so flush() can wait for it.
+#define clearTxComplete() (UCSR0A = (UCSR0A & (bit(U2X0) | bit(MPCM0))) | bit(TXC0))
+
+// Define the global instance
+FastSerial fastSerial;
+
+// --- Rings: the ISR owns the RX head and TX tail, the sketch side owns the others ---
+static uint8_t rxBuffer[FAST_SERIAL_RX_BUFFER_SIZE];
+static volatile uint8_t rxHead = 0;
+static volatile uint8_t rxTail = 0;
+static uint8_t txBuffer[FAST_SERIAL_TX_BUFFER_SIZE];
+static volatile uint8_t txHead = 0;
+static volatile uint8_t txTail = 0;
+static bool txWritten = false;
+
+/**
+ * @brief Moves the next queued byte into the USART. Called from the data register
+ *        empty ISR, or by polling when a write happens with interrupts disabled.
+ */
+static inline void txNext() {
+  if (txHead == txTail || !ctsAsserted()) {
+    UCSR0B &= ~bit(UDRIE0); // Nothing to send or the host is not ready, CTS will re-enable us.
+    return;
+  }
+  UDR0 = txBuffer[txTail];
+  txTail = (txTail + 1) & TX_MASK;
+  clearTxComplete();
+}
+
+ISR(USART_RX_vect) {
+  bool frameError = UCSR0A & bit(FE0); // Status must be read before UDR0
+  uint8_t data = UDR0;
+  uint8_t next = (rxHead + 1) & RX_MASK;
+  if (!frameError && next != rxTail) { // Drop the byte if it is garbled or the ring is full
+    rxBuffer[rxHead] = data;
+    rxHead = next;
+  }
+#ifdef FAST_SERIAL_FLOW_CONTROL
+  if (((uint8_t)(rxHead - rxTail) & RX_MASK) >= FAST_SERIAL_RTS_HIGH_WATER) {
+    digitalWriteFast(FAST_SERIAL_RTS_PIN, HIGH); // Ask the host to pause
+  }
+#endif
+}
+
+ISR(USART_UDRE_vect) {
+  txNext();
+}
+
+#ifdef FAST_SERIAL_FLOW_CONTROL
+ISR(PCINT1_vect) {
+  if (ctsAsserted() && txHead != txTail) {
+    UCSR0B |= bit(UDRIE0); // Host is ready again, resume sending
+  }
+}
+#endif
+
+/**
+ * @brief Configures USART0 for 8N1 in double speed mode and enables the RX interrupt.
+ * @param baud Up to F_CPU / 8 (2000000 at 16MHz). 500000, 1000000 and 2000000
+ *             have no rate error at 16MHz.
+ */
+void FastSerial::begin(unsigned long baud) {
+  uint16_t baudSetting = (F_CPU / 4 / baud - 1) / 2; // Rounded UBRR for U2X0
+  UCSR0A = bit(U2X0);
+  UBRR0H = baudSetting >> 8;
+  UBRR0L = baudSetting & 0xFF;
+  UCSR0C = bit(UCSZ01) | bit(UCSZ00); // 8 data bits, no parity, 1 stop bit
+  UCSR0B = bit(RXEN0) | bit(TXEN0) | bit(RXCIE0);
+#ifdef FAST_SERIAL_FLOW_CONTROL
+  digitalWriteFast(FAST_SERIAL_RTS_PIN, LOW); // Ready to receive
+  pinModeFast(FAST_SERIAL_RTS_PIN, OUTPUT);
+  pinModeFast(FAST_SERIAL_CTS_PIN, INPUT);
+  digitalWriteFast(FAST_SERIAL_CTS_PIN, HIGH); // Pull-up, an unconnected host is never clear to send
+  PCMSK1 |= bit(digitalPinToBit(FAST_SERIAL_CTS_PIN));
+  PCICR |= bit(PCIE1);
+#endif
+}
+
+void FastSerial::end() {
+  flush();
+  UCSR0B = 0;
+  rxHead = rxTail;
+#ifdef FAST_SERIAL_FLOW_CONTROL
+  PCMSK1 &= ~bit(digitalPinToBit(FAST_SERIAL_CTS_PIN));
+#endif
+}
+
+int FastSerial::available() {
+  return (uint8_t)(rxHead - rxTail) & RX_MASK;
+}
+
+int FastSerial::peek() {
+  if (rxHead == rxTail) {
+    return -1;
+  }
+  return rxBuffer[rxTail];
+}
+
+int FastSerial::read() {
+  if (rxHead == rxTail) {
+    return -1;
+  }
+  uint8_t data = rxBuffer[rxTail];
+  rxTail = (rxTail + 1) & RX_MASK;
+#ifdef FAST_SERIAL_FLOW_CONTROL
+  if (((uint8_t)(rxHead - rxTail) & RX_MASK) <= FAST_SERIAL_RTS_LOW_WATER) {
+    digitalWriteFast(FAST_SERIAL_RTS_PIN, LOW); // Room again, let the host continue
+  }
+#endif
+  return data;
+}
+
+int FastSerial::availableForWrite() {
+  return (uint8_t)(txTail - txHead - 1) & TX_MASK;
+}
+
+/**
+ * @brief Waits until every queued byte, including the last stop bit, has left the USART.
+ */
+void FastSerial::flush() {
+  if (!txWritten) {
+    return; // TXC0 is never set if nothing was sent
+  }
+  while (txHead != txTail || bit_is_clear(UCSR0A, TXC0)) {
+    if (bit_is_clear(SREG, SREG_I) && bit_is_set(UCSR0A, UDRE0)) {
+      txNext(); // Interrupts are off, drain the ring by polling
+    }
+  }
+}
+
+size_t FastSerial::write(uint8_t data) {
+  txWritten = true;
+  // Empty ring and a free data register: skip the ring and the interrupt entirely.
+  if (txHead == txTail && bit_is_set(UCSR0A, UDRE0) && ctsAsserted()) {
+    UDR0 = data;
+    clearTxComplete();
+    return 1;
+  }
+  uint8_t next = (txHead + 1) & TX_MASK;
+  while (next == txTail) { // Ring is full, wait for the ISR to make room
+    if (bit_is_clear(SREG, SREG_I) && bit_is_set(UCSR0A, UDRE0)) {
+      txNext(); // Interrupts are off, drain the ring by polling
+    }
+  }
+  txBuffer[txHead] = data;
+  txHead = next;
+  UCSR0B |= bit(UDRIE0);
+  return 1;
+}
+
+/**
+ * @brief Copies a whole buffer into the TX ring and enables the ISR once,
+ *        instead of once per byte as Print::write would.
+ */
+size_t FastSerial::write(const uint8_t* buffer, size_t size) {
+  txWritten = true;
+  for (size_t i = 0; i < size; i++) {
+    uint8_t next = (txHead + 1) & TX_MASK;
+    if (next == txTail) {
+      UCSR0B |= bit(UDRIE0); // Let the ISR drain what we queued so far
+      write(buffer[i]); // Ring is full, fall back to the waiting path
+      continue;
+    }
+    txBuffer[txHead] = buffer[i];
+    txHead = next;
+  }
+  UCSR0B |= bit(UDRIE0);
+  return size;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef FastSerial_H
+#define FastSerial_H
+#include <Arduino.h> // Include Arduino core library for Stream
+
+/* Optional replacement for HardwareSerial, enabled with GPIB_FAST_SERIAL in GPIBnano.h.
+It drives USART0 in double speed mode (500000, 1000000 and 2000000 baud are exact at 16MHz)
+and services larger RX/TX rings from its own ISRs. Because it defines the USART vectors,
+nothing in the sketch may reference Serial while it is enabled; use GPIB_SERIAL instead.
+*/
+
+// note, ring sizes must be a power of two and no larger than 256.
+// One slot of each ring is kept free to tell full from empty.
+#define FAST_SERIAL_RX_BUFFER_SIZE 256
+#define FAST_SERIAL_TX_BUFFER_SIZE 128
+
+// --- Optional RTS/CTS flow control on spare pins ---
+// RTS is asserted (LOW) while the RX ring has room and released above the high
+// water mark. We only transmit while the host asserts CTS (LOW). CTS uses the
+// pin change interrupt of port C, so it must be A0-A5 and PCINT1_vect must be
+// otherwise unused (e.g. no SoftwareSerial).
+//#define FAST_SERIAL_FLOW_CONTROL
+#define FAST_SERIAL_RTS_PIN 13
+#define FAST_SERIAL_CTS_PIN 19 // A5
+#define FAST_SERIAL_RTS_HIGH_WATER (FAST_SERIAL_RX_BUFFER_SIZE - 32)
+#define FAST_SERIAL_RTS_LOW_WATER (FAST_SERIAL_RX_BUFFER_SIZE / 2)
+
+class FastSerial : public Stream {
+public:
+    void begin(unsigned long baud);
+    void end();
+    virtual int available();
+    virtual int peek();
+    virtual int read();
+    virtual int availableForWrite();
+    virtual void flush();
+    virtual size_t write(uint8_t data);
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    using Print::write; // pull in write(str) and write(buf, size) from Print
+    operator bool() { return true; }
+};
+
+extern FastSerial fastSerial;
+
+#endif
@@ -1,4 +1,5 @@
 #include "GPIBnano.h"
+#include <avr/eeprom.h>
 // Define the global instance
 GPIBnano gpibNano;
 
@@ -16,13 +17,146 @@ uint8_t controllerAddress = 0;
 GpibState gpibState = GPIB_IDLE;
 TalkerState talkerState = T_IDLE;
 
-unsigned long listenTimeoutTimestamp = 0;
+// --- Deadline of the current phase, armed when gpibFSM first sees a state of a new phase ---
+unsigned long phaseTimestamp = 0;
+GpibError armedPhase = GPIB_OK; // the error an overrun raises, GPIB_OK means no deadline
+GpibError gpibError = GPIB_OK; // last error, cleared by the next command
+
+#ifdef GPIB_DEBUG
+  unsigned long debugSteps = 0; // FSM steps and bytes moved, for steps per byte
+  unsigned long debugBytes = 0;
+#endif
+
+// --- State table ---
+// One row per state of both machines, GpibState rows first, then TalkerState.
+// A row says what the state waits for, where it goes and which phase it is in:
+// pin bits that must read (pins & waitMask) == waitValue, IN_* conditions that
+// must read (flags & flagMask) == flagValue, and a time the state must have been
+// active. Once ready the state moves to next and its step (if it has one in
+// gpibFSM/updateTalkerFSM) runs and may pick another state. While not ready, the
+// exit state is taken instead if the flags read (flags & exitMask) == exitValue.
+// The phase is the GpibError raised if the state is still active when that
+// phase's deadline passes. A state that only waits needs nothing but its row.
+#define IN_TALKER_IDLE 0x01 // talkerState == T_IDLE && queueCount == 0
+#define IN_QUEUED_BYTE 0x02 // queueCount > 0
+#define IN_DEVICE_ACCEPT 0x04 // device mode: ATN asserted or addressed to listen
+#define IN_DEVICE_TALK 0x08 // device mode: addressed to talk and ATN released
+#define IN_DEVICE_TALKING 0x10 // device mode: addressed to talk
+#define IN_NEVER 0x80 // never set, parks a state until a command moves it
+
+struct StateRow {
+  uint16_t waitMask;
+  uint16_t waitValue;
+  uint8_t flagMask;
+  uint8_t flagValue;
+  uint16_t settleUs;
+  uint8_t phase;
+  uint8_t next;
+  uint8_t exitMask; // 0 for no exit
+  uint8_t exitValue;
+  uint8_t exitState;
+};
+
+// Ready once the IN_* flags in needs are set.
+constexpr StateRow step(uint8_t next, uint8_t needs = 0, GpibError phase = GPIB_OK) {
+  return StateRow{0, 0, needs, needs, 0, (uint8_t)phase, next, 0, 0, 0};
+}
+constexpr StateRow waitPins(uint16_t mask, uint16_t value, uint8_t next, GpibError phase = GPIB_OK) {
+  return StateRow{mask, value, 0, 0, 0, (uint8_t)phase, next, 0, 0, 0};
+}
+constexpr StateRow waitAsserted(uint8_t pinBit, uint8_t next, GpibError phase = GPIB_OK) {
+  return waitPins((uint16_t)(1 << pinBit), (uint16_t)(1 << pinBit), next, phase);
+}
+constexpr StateRow waitReleased(uint8_t pinBit, uint8_t next, GpibError phase = GPIB_OK) {
+  return waitPins((uint16_t)(1 << pinBit), 0, next, phase);
+}
+constexpr StateRow waitSettled(uint16_t us, uint8_t next, GpibError phase = GPIB_OK) {
+  return StateRow{0, 0, 0, 0, us, (uint8_t)phase, next, 0, 0, 0};
+}
+// The same row, also needing the IN_* flags in needs to be set.
+constexpr StateRow andNeeds(StateRow r, uint8_t needs) {
+  return StateRow{r.waitMask, r.waitValue, (uint8_t)(r.flagMask | needs), (uint8_t)(r.flagValue | needs),
+                  r.settleUs, r.phase, r.next, r.exitMask, r.exitValue, r.exitState};
+}
+// The same row, leaving for state while the IN_* flags in mask read value.
+constexpr StateRow orExit(StateRow r, uint8_t mask, uint8_t value, uint8_t state) {
+  return StateRow{r.waitMask, r.waitValue, r.flagMask, r.flagValue, r.settleUs, r.phase, r.next, mask, value, state};
+}
+
+constexpr StateRow stateTable[] PROGMEM = {
+// GpibState rows
+  step(LISTEN_BEGIN_HANDSHAKE, IN_TALKER_IDLE, GPIB_ERR_LISTEN_TIMEOUT), // LISTEN_SETUP_ADDRESSES
+  step(LISTEN_READY_FOR_DATA, IN_TALKER_IDLE, GPIB_ERR_LISTEN_TIMEOUT), // LISTEN_BEGIN_HANDSHAKE
+  step(LISTEN_WAIT_FOR_DAV, 0, GPIB_ERR_LISTEN_TIMEOUT), // LISTEN_READY_FOR_DATA
+  waitAsserted(DAV_BIT, LISTEN_DATA_RECEIVED, GPIB_ERR_LISTEN_TIMEOUT), // LISTEN_WAIT_FOR_DAV
+  step(LISTEN_WAIT_FOR_DAV_RELEASE, 0, GPIB_ERR_LISTEN_TIMEOUT), // LISTEN_DATA_RECEIVED
+  waitReleased(DAV_BIT, LISTEN_FINISH_BYTE_HANDSHAKE, GPIB_ERR_LISTEN_TIMEOUT), // LISTEN_WAIT_FOR_DAV_RELEASE
+  step(LISTEN_READY_FOR_DATA, 0, GPIB_ERR_LISTEN_TIMEOUT), // LISTEN_FINISH_BYTE_HANDSHAKE
+  step(LISTEN_UNADDRESS_SEND_UNT, IN_TALKER_IDLE, GPIB_ERR_UNADDRESS_TIMEOUT), // LISTEN_UNADDRESS_START_ATN
+  // We also accept our own UNT, so without a pause it could complete before a
+  // slow acceptor has seen ATN, leaving a device mode Nano still addressed.
+  waitSettled(ATN_SETTLE_US, LISTEN_UNADDRESS_WAIT_FOR_DAV, GPIB_ERR_UNADDRESS_TIMEOUT), // LISTEN_UNADDRESS_SEND_UNT
+  waitAsserted(DAV_BIT, LISTEN_UNADDRESS_ACK, GPIB_ERR_UNADDRESS_TIMEOUT), // LISTEN_UNADDRESS_WAIT_FOR_DAV
+  waitReleased(DAV_BIT, LISTEN_UNADDRESS_WAIT_FOR_IDLE, GPIB_ERR_UNADDRESS_TIMEOUT), // LISTEN_UNADDRESS_ACK
+  step(LISTEN_UNADDRESS_FINISH, IN_TALKER_IDLE, GPIB_ERR_UNADDRESS_TIMEOUT), // LISTEN_UNADDRESS_WAIT_FOR_IDLE
+  step(GPIB_COMPLETE, IN_TALKER_IDLE, GPIB_ERR_UNADDRESS_TIMEOUT), // LISTEN_UNADDRESS_FINISH
+  step(WRITE_SEND_BODY, IN_TALKER_IDLE, GPIB_ERR_WRITE_TIMEOUT), // WRITE_SETUP_ADDRESSES
+  step(WRITE_SEND_FINAL_CHAR, IN_TALKER_IDLE, GPIB_ERR_WRITE_TIMEOUT), // WRITE_SEND_BODY
+  step(WRITE_FINISH, IN_TALKER_IDLE, GPIB_ERR_WRITE_TIMEOUT), // WRITE_SEND_FINAL_CHAR
+  step(GPIB_COMPLETE, IN_TALKER_IDLE, GPIB_ERR_WRITE_TIMEOUT), // WRITE_FINISH
+  step(INIT_PULSE_IFC_WAIT, 0, GPIB_ERR_INIT_TIMEOUT), // INIT_PULSE_IFC_START
+  waitSettled(IFC_PULSE_US, INIT_PULSE_IFC_END, GPIB_ERR_INIT_TIMEOUT), // INIT_PULSE_IFC_WAIT
+  step(INIT_ASSERT_REN_ATN, 0, GPIB_ERR_INIT_TIMEOUT), // INIT_PULSE_IFC_END
+  step(INIT_SEND_UNL, 0, GPIB_ERR_INIT_TIMEOUT), // INIT_ASSERT_REN_ATN
+  step(INIT_SEND_UNT, IN_TALKER_IDLE, GPIB_ERR_INIT_TIMEOUT), // INIT_SEND_UNL
+  step(INIT_FINISH, IN_TALKER_IDLE, GPIB_ERR_INIT_TIMEOUT), // INIT_SEND_UNT
+  step(GPIB_COMPLETE, IN_TALKER_IDLE, GPIB_ERR_INIT_TIMEOUT), // INIT_FINISH
+  step(RECOVER_CLEAR_FINISH, IN_TALKER_IDLE, GPIB_ERR_CLEAR_TIMEOUT), // RECOVER_CLEAR_START
+  step(GPIB_COMPLETE, IN_TALKER_IDLE, GPIB_ERR_CLEAR_TIMEOUT), // RECOVER_CLEAR_FINISH
+  step(RECOVER_IFC_END), // RECOVER_IFC_START
+  waitSettled(IFC_PULSE_US, GPIB_COMPLETE), // RECOVER_IFC_END
+  step(SCAN_LISTEN, IN_TALKER_IDLE), // SCAN_NEXT_ENTRY
+  step(LISTEN_SETUP_ADDRESSES, IN_TALKER_IDLE), // SCAN_LISTEN
+  step(SCAN_NEXT_ENTRY, IN_TALKER_IDLE), // SCAN_REPORT
+  step(GPIB_IDLE), // GPIB_COMPLETE
+  step(GPIB_IDLE, IN_NEVER), // GPIB_IDLE
+  orExit(step(DEVICE_ACCEPT_READY, IN_DEVICE_ACCEPT), IN_DEVICE_TALK, IN_DEVICE_TALK, DEVICE_TALK_PUT_BYTE), // DEVICE_IDLE
+  step(DEVICE_ACCEPT_WAIT_DAV), // DEVICE_ACCEPT_READY
+  orExit(waitAsserted(DAV_BIT, DEVICE_ACCEPT_WAIT_DAV_RELEASE), IN_DEVICE_ACCEPT, 0, DEVICE_ACCEPT_END), // DEVICE_ACCEPT_WAIT_DAV
+  waitReleased(DAV_BIT, DEVICE_ACCEPT_READY), // DEVICE_ACCEPT_WAIT_DAV_RELEASE
+  step(DEVICE_IDLE), // DEVICE_ACCEPT_END
+  orExit(step(DEVICE_TALK_WAIT_NRFD_RELEASED, IN_DEVICE_TALK), IN_DEVICE_TALK, 0, DEVICE_TALK_END), // DEVICE_TALK_PUT_BYTE
+  orExit(andNeeds(waitPins((1 << NDAC_BIT) | (1 << NRFD_BIT), 1 << NDAC_BIT, DEVICE_TALK_WAIT_NDAC_RELEASED), IN_DEVICE_TALK),
+         IN_DEVICE_TALK, 0, DEVICE_TALK_END), // DEVICE_TALK_WAIT_NRFD_RELEASED
+  orExit(waitReleased(NDAC_BIT, DEVICE_IDLE), IN_DEVICE_TALKING, 0, DEVICE_TALK_END), // DEVICE_TALK_WAIT_NDAC_RELEASED
+  step(DEVICE_IDLE), // DEVICE_TALK_END
+// TalkerState rows
+  step(T_WAIT_NDAC_ASSERTED, IN_QUEUED_BYTE), // T_IDLE
+  waitAsserted(NDAC_BIT, T_WAIT_NRFD_RELEASED), // T_WAIT_NDAC_ASSERTED
+  waitReleased(NRFD_BIT, T_WAIT_NDAC_RELEASED), // T_WAIT_NRFD_RELEASED
+  waitReleased(NDAC_BIT, T_IDLE) // T_WAIT_NDAC_RELEASED
+};
+static_assert(sizeof(stateTable) / sizeof(StateRow) == GPIB_STATE_COUNT + T_STATE_COUNT,
+              "stateTable needs one row per GpibState and TalkerState");
+
+// Deadline of each phase, indexed by the GpibError its overrun raises.
+const uint16_t phaseTimeouts[] PROGMEM = {
+  0, // GPIB_OK
+  INIT_TIMEOUT_MS,
+  WRITE_TIMEOUT_MS,
+  LISTEN_TIMEOUT_MS,
+  UNADDRESS_TIMEOUT_MS,
+  CLEAR_TIMEOUT_MS
+};
 
 uint8_t initTargetAddress = 255;
-unsigned long ifcPulseTimestamp = 0;
+uint8_t initTargetSecondary = NO_SECONDARY_ADDRESS;
+bool writeRetried = false; // the current *WRITE was already readdressed once
 
 uint8_t lastTalker = 255;
+uint8_t lastTalkerSecondary = NO_SECONDARY_ADDRESS;
 uint8_t lastListener = 255;
+uint8_t lastListenerSecondary = NO_SECONDARY_ADDRESS;
 
 char writeString[MAX_WRITE_STRING_LENGTH];
 
@@ -33,16 +167,119 @@ char writeString[MAX_WRITE_STRING_LENGTH];
 #endif
 
 char receivedData[MAX_RECEIVE_LENGTH];
+char resultBuffer[MAX_RESULT_LENGTH]; // the raw reading, or the reduced one
 int receivedDataIndex = 0; // Index to track where to write next in the array
+uint16_t listenEos = NO_EOS; // byte that ends a reading like EOI, set per *LISTEN or scan entry
+uint16_t listenTimeoutMs = LISTEN_TIMEOUT_MS; // deadline of the LISTEN phase
 
 bool resultReady = false;
+bool resultIsBinary = false; // format of the result in resultBuffer
+const char* resultData = resultBuffer;
+uint8_t resultDataLength = 0;
+
+// --- Reading reduction (*REDUCE, *FORMAT) ---
+ReduceMode reduceMode = REDUCE_NONE;
+uint16_t reduceBlockSize = 1;
+bool binaryOutput = false;
+uint16_t listenRemaining = 0; // readings left in the current *LISTEN
+uint16_t reduceCount = 0;
+uint8_t binaryValueCount = 0; // floats packed after the header space of resultBuffer
+float reduceMean = 0; // running mean and sum of squared deviations (Welford)
+float reduceM2 = 0;
+float reduceMin = 0;
+float reduceMax = 0;
+
+// --- Device mode (*DEVICE, *PATTERN) ---
+bool deviceMode = false;
+uint8_t deviceAddress = 0;
+uint8_t deviceSecondary = NO_SECONDARY_ADDRESS; // extended addressing, MLA/MTA must be followed by this MSA
+bool deviceListening = false; // addressed by our MLA (and MSA)
+bool deviceTalking = false; // addressed by our MTA (and MSA)
+bool deviceListenPending = false; // our MLA arrived, waiting for the MSA
+bool deviceTalkPending = false; // our MTA arrived, waiting for the MSA
+bool devicePatternCount = true; // talk decimal message counts instead of devicePattern
+char devicePattern[MAX_WRITE_STRING_LENGTH];
+char deviceCountText[11]; // current counting message, fits any unsigned long
+const char* deviceTxMessage = deviceCountText;
+uint8_t deviceTxIndex = 0;
+uint8_t deviceTxLength = 0;
+uint8_t deviceRxLength = 0; // length of the message being received, may exceed receivedData
+unsigned long deviceRxExpected = 0; // next count expected from the controller
+unsigned long deviceTxMessages = 0;
+unsigned long deviceRxMessages = 0;
+unsigned long deviceRxErrors = 0;
+
+// --- Scan list (*SCAN) ---
+ScanEntry scanEntries[MAX_SCAN_ENTRIES];
+uint8_t scanEntryCount = 0;
+bool scanRunning = false;
+bool scanContinuous = false; // run until the host sends anything
+uint16_t scanCyclesRemaining = 0;
+uint8_t scanIndex = 0; // entry being read, 0 starts a new row
+unsigned long scanCycle = 0;
+unsigned long scanCycleStart = 0;
+unsigned long scanEntryStart = 0;
+uint8_t scanSavedAddress = 255; // *ADDR target to restore when the scan ends
+uint8_t scanSavedSecondary = NO_SECONDARY_ADDRESS;
+
+// An entry read back from EEPROM must pass the same checks as a typed one.
+static bool isScanEntryValid(const ScanEntry* entry) {
+  return entry->address >= 1 && entry->address <= 30
+      && (entry->secondary <= 30 || entry->secondary == NO_SECONDARY_ADDRESS)
+      && (entry->eos <= 255 || entry->eos == NO_EOS)
+      && entry->timeoutMs >= 1;
+}
 
 /* --- main function to do everything but output --- */
 void GPIBnano::processGPIB() {
   handleSerialInput(); // queue input, parse commands, and dispatch them.
-  uint16_t currentPinStates = readGpibPins();
-  gpibFSM(currentPinStates);
-  updateTalkerFSM(currentPinStates);
+  // Keep stepping both FSMs while either one moves, so a byte handshake with a
+  // fast device completes in one call instead of one call per state.
+  for (uint8_t step = 0; step < MAX_FSM_STEPS; step++) {
+    if (gpibState == GPIB_IDLE && talkerState == T_IDLE) {
+      break; // Nothing on the bus is ours to watch.
+    }
+#ifdef GPIB_DEBUG
+    debugSteps++;
+#endif
+    uint16_t currentPinStates = readGpibPins();
+    bool moved = gpibFSM(currentPinStates);
+    moved |= updateTalkerFSM(currentPinStates);
+#ifdef GPIB_DEBUG
+    reportPinStates(currentPinStates);
+#endif
+    if (!moved) {
+      break; // Waiting on a line, the deadline or the sketch.
+    }
+  }
+}
+
+/**
+ * @brief The IN_* conditions rows can wait on besides the pins.
+ */
+uint8_t GPIBnano::readInputFlags(uint16_t currentPinStates) {
+  uint8_t flags = 0;
+  if (queueCount > 0) {
+    flags |= IN_QUEUED_BYTE;
+  } else if (talkerState == T_IDLE) {
+    flags |= IN_TALKER_IDLE;
+  }
+  if (getATN || deviceListening) {
+    flags |= IN_DEVICE_ACCEPT;
+  }
+  if (deviceTalking) {
+    flags |= getATN ? IN_DEVICE_TALKING : IN_DEVICE_TALKING | IN_DEVICE_TALK;
+  }
+  return flags;
+}
+
+/**
+ * @brief True if the state described by the table row has what it waits for,
+ *        apart from its settle time.
+ */
+bool GPIBnano::isRowReady(const StateRow* tableRow, uint16_t currentPinStates, uint8_t inputFlags) {
+  return (inputFlags & pgm_read_byte(&tableRow->flagMask)) == pgm_read_byte(&tableRow->flagValue)
+      && (currentPinStates & pgm_read_word(&tableRow->waitMask)) == pgm_read_word(&tableRow->waitValue);
 }
 
 bool GPIBnano::isResult() {
@@ -52,54 +289,73 @@ bool GPIBnano::isResult() {
 const char* GPIBnano::result() {
     if (resultReady) {
         resultReady = false;
-        receivedDataIndex = 0; // Reset index for the next read
 #ifdef GPIB_DEBUG
-        Serial.print(F("LISTEN: Received from instrument: "));
+        GPIB_SERIAL.print(F("LISTEN: Received from instrument: "));
 #endif
-        return receivedData; // Return the character array
+        return resultData; // Return the character array
     } else {
         const char* dummy = "";
         return dummy; // Return an empty string
     }
 }
 
+/**
+ * @brief Number of bytes in the current result. Binary results may contain
+ *        zero bytes, so use this rather than strlen() when isBinaryResult().
+ */
+uint8_t GPIBnano::resultLength() {
+  return resultDataLength;
+}
+
+/**
+ * @brief True if the current result is a "#<digits><length><floats>" block
+ *        rather than text, whatever *FORMAT has been set to since.
+ */
+bool GPIBnano::isBinaryResult() {
+  return resultIsBinary;
+}
+
+/**
+ * @brief The error that ended the last command, or GPIB_OK.
+ */
+GpibError GPIBnano::error() {
+  return gpibError;
+}
+
 /**
  * @brief State machine to manage the low-level Talker handshake.
  * This version now correctly appends ASCII characters to the sentData buffer.
+ * @return true if the Talker FSM changed state.
  */
-void GPIBnano::updateTalkerFSM(uint16_t currentPinStates) {
+bool GPIBnano::updateTalkerFSM(uint16_t currentPinStates) {
   static uint8_t currentSendingByte = 0;
 #ifdef GPIB_DEBUG
   static bool currentIsHex = false;
 #endif
-  switch (talkerState) {
-    case T_IDLE: // 0
-      if (queueCount > 0) {
-        currentSendingByte = sendQueue[queueHead];
+  const StateRow* tableRow = &stateTable[GPIB_STATE_COUNT + talkerState];
+  if (!isRowReady(tableRow, currentPinStates, readInputFlags(currentPinStates))) {
+    return false; // Still waiting on the line this state watches.
+  }
+  TalkerState previousState = talkerState;
+  talkerState = (TalkerState)pgm_read_byte(&tableRow->next);
+  switch (previousState) {
+    case T_IDLE: // 0 (row waits for a queued byte)
+      currentSendingByte = sendQueue[queueHead];
 #ifdef GPIB_DEBUG
-        currentIsHex = sendQueueIsHex[queueHead];
+      currentIsHex = sendQueueIsHex[queueHead];
 #endif
-        queueHead = (queueHead + 1) % QUEUE_SIZE;
-        queueCount--;
-        setDioPins(currentSendingByte);
-        talkerState = T_WAIT_NDAC_ASSERTED;
-      }
+      queueHead = (queueHead + 1) % QUEUE_SIZE;
+      queueCount--;
+      setDioPins(currentSendingByte);
       break;
-    case T_WAIT_NDAC_ASSERTED: // 1
-      if (getNDAC) {
-        talkerState = T_WAIT_NRFD_RELEASED;
-      }
+    case T_WAIT_NRFD_RELEASED: // 2 (row waits for NRFD released)
+      assertPin(DAV_PIN);
       break;
-    case T_WAIT_NRFD_RELEASED: // 2
-      if (!getNRFD) {
-        assertPin(DAV_PIN);
-        talkerState = T_WAIT_NDAC_RELEASED;
-      }
-      break;
-    case T_WAIT_NDAC_RELEASED: // 3
-      if (!getNDAC) {
-        releasePin(DAV_PIN);
+    case T_WAIT_NDAC_RELEASED: // 3 (row waits for NDAC released)
+      {
+        releasePin(DAV_PIN); // Handshake complete
 #ifdef GPIB_DEBUG
+        debugBytes++;
         if (currentIsHex) {
           size_t currentLength = strlen(sentData);
           if (currentLength + 3 < MAX_WRITE_STRING_LENGTH) {
@@ -108,7 +364,7 @@ void GPIBnano::updateTalkerFSM(uint16_t currentPinStates) {
             sentData[currentLength + 2] = ' '; //pad
             sentData[currentLength + 3] = '\0'; //terminate
           } else {
-            Serial.print(F("Out of space in: sentData."));
+            GPIB_SERIAL.print(F("Out of space in: sentData."));
           }
         } else {
           uint8_t len=strlen(sentData);
@@ -116,273 +372,693 @@ void GPIBnano::updateTalkerFSM(uint16_t currentPinStates) {
           sentData[len+1] = '\0';
         }
 #endif
-        talkerState = T_IDLE; // Handshake complete
       }
       break;
+    default: // T_WAIT_NDAC_ASSERTED only waits
+      break;
   }
+  return true; // Every talker row moves to another state.
 }
 
 /**
- * @brief Queues the standard sequence of GPIB command bytes to unaddress all
- *        devices and then assign a new Talker and a new Listener.
- * @note This function is now state-aware. It will do nothing if the requested
- *       talker and listener are already the active ones.
+ * @brief Queues the GPIB command bytes needed to make the given devices the
+ *        Talker and the Listener, sending only what differs from the last call.
+ * @note A new listener needs UNL followed by its MLA (and MSA). A new talker
+ *       only needs its MTA (and MSA), since any other talk address untalks the
+ *       previous talker. If neither changed, nothing is queued.
  * @note The ATN line must be asserted by the caller BEFORE this function is
  *       called and released AFTER the queued bytes have been sent.
- * @param talkerAddress The address (0-30) of the target Talker device.
- * @param listenerAddress The address (0-30) of the target Listener device.
+ * @param talkerAddress The primary address (0-30) of the target Talker device.
+ * @param talkerSecondary The secondary address (0-30) or NO_SECONDARY_ADDRESS.
+ * @param listenerAddress The primary address (0-30) of the target Listener device.
+ * @param listenerSecondary The secondary address (0-30) or NO_SECONDARY_ADDRESS.
  */
-void GPIBnano::setTalkerListener(uint8_t talkerAddress, uint8_t listenerAddress) {
-  // CHANGE: Check if the bus is already configured as requested.
-  // If so, do nothing and return early to prevent redundant commands.
-  if (talkerAddress == lastTalker && listenerAddress == lastListener) {
-    return;
+void GPIBnano::setTalkerListener(uint8_t talkerAddress, uint8_t talkerSecondary,
+                                 uint8_t listenerAddress, uint8_t listenerSecondary) {
+  if (listenerAddress != lastListener || listenerSecondary != lastListenerSecondary) {
+    queueByte(0x3F, true); // UNL (Unlisten)
+    queueByte(0x20 | listenerAddress, true); // MLA (My Listen Address)
+    if (listenerSecondary != NO_SECONDARY_ADDRESS) {
+      queueByte(0x60 | listenerSecondary, true); // MSA (My Secondary Address)
+    }
+    lastListener = listenerAddress;
+    lastListenerSecondary = listenerSecondary;
   }
 
-  // If the state is different, proceed with re-addressing the bus.
-  queueByte(0x3F, true); // UNL (Unlisten)
-  queueByte(0x5F, true); // UNT (Untalk)
-
-  uint8_t mta = 0x40 | talkerAddress;
-  queueByte(mta, true); // MTA (My Talk Address)
-
-  uint8_t mla = 0x20 | listenerAddress;
-  queueByte(mla, true); // MLA (My Listen Address)
-
-  // CHANGE: After queuing the new commands, update the stored state
-  // to remember the new configuration.
-  lastTalker = talkerAddress;
-  lastListener = listenerAddress;
+  if (talkerAddress != lastTalker || talkerSecondary != lastTalkerSecondary) {
+    queueByte(0x40 | talkerAddress, true); // MTA (My Talk Address)
+    if (talkerSecondary != NO_SECONDARY_ADDRESS) {
+      queueByte(0x60 | talkerSecondary, true); // MSA (My Secondary Address)
+    }
+    lastTalker = talkerAddress;
+    lastTalkerSecondary = talkerSecondary;
+  }
 }
 
-void GPIBnano::gpibFSM(uint16_t currentPinStates) {
+/**
+ * @brief Moves to the next state of the current stateTable row once it is
+ *        ready and runs the step of the state being left, takes the row's exit
+ *        instead if that applies, and aborts the phase if it is still waiting
+ *        past its deadline.
+ * @return true if gpibState changed.
+ */
+bool GPIBnano::gpibFSM(uint16_t currentPinStates) {
   static bool eoi_was_detected = false;
-  // talkerReady is true when the low-level Talker FSM is idle AND the send queue is empty.
-  bool talkerReady = (talkerState == T_IDLE && queueCount == 0);
-  
-  // The timeout check now excludes all final cleanup states.
-  if (gpibState < LISTEN_UNADDRESS_START_ATN && (millis() - listenTimeoutTimestamp > LISTEN_TIMEOUT_MS)) {
-    Serial.println(F("ERROR: *LISTEN timed out after 3 seconds."));
-    releasePin(ATN_PIN);
-    gpibState = LISTEN_UNADDRESS_FINISH; // Force cleanup
-    return;
+  static GpibState enteredState = GPIB_STATE_COUNT;
+  static unsigned long enteredMicros = 0; // when enteredState was first seen, for settle times
+  const StateRow* tableRow = &stateTable[gpibState];
+  GpibError phase = (GpibError)pgm_read_byte(&tableRow->phase);
+  if (phase != armedPhase) { // First step of a new phase, start its deadline.
+    armedPhase = phase;
+    phaseTimestamp = millis();
+  }
+  if (gpibState != enteredState) {
+    enteredState = gpibState;
+    enteredMicros = micros();
+  }
+
+  if (deviceMode && getIFC) { // The controller in charge unaddressed everyone
+    deviceListening = false;
+    deviceTalking = false;
+  }
+
+  uint8_t inputFlags = readInputFlags(currentPinStates);
+  if (!isRowReady(tableRow, currentPinStates, inputFlags)
+      || micros() - enteredMicros < pgm_read_word(&tableRow->settleUs)) {
+    uint8_t exitMask = pgm_read_byte(&tableRow->exitMask);
+    if (exitMask != 0 && (inputFlags & exitMask) == pgm_read_byte(&tableRow->exitValue)) {
+      gpibState = (GpibState)pgm_read_byte(&tableRow->exitState);
+      return true;
+    }
+    // Every phase that waits on another device has a deadline.
+    uint16_t timeout = armedPhase == GPIB_ERR_LISTEN_TIMEOUT ? listenTimeoutMs : pgm_read_word(&phaseTimeouts[armedPhase]);
+    if (armedPhase != GPIB_OK && (millis() - phaseTimestamp > timeout)) {
+      recoverBus();
+      return true;
+    }
+    return false;
   }
 
-  switch (gpibState) {
-// LISTEN state#endif
+  GpibState previousState = gpibState;
+  gpibState = (GpibState)pgm_read_byte(&tableRow->next);
+  switch (previousState) {
+// LISTEN states
 
     // --- Phase 1: Configure the bus ---
     case LISTEN_SETUP_ADDRESSES:
-      if (talkerReady) {
 #ifdef GPIB_DEBUG
-        Serial.println(F("LISTEN: Asserting ATN and setting addresses."));
+      GPIB_SERIAL.println(F("LISTEN: Asserting ATN and setting addresses."));
 #endif
-        assertPin(ATN_PIN);
-        setTalkerListener(initTargetAddress, controllerAddress);
-        gpibState = LISTEN_BEGIN_HANDSHAKE;
-      }
+      assertPin(ATN_PIN);
+      setTalkerListener(initTargetAddress, initTargetSecondary, controllerAddress, NO_SECONDARY_ADDRESS);
       break;
     case LISTEN_BEGIN_HANDSHAKE:
-      if (talkerReady) {
 #ifdef GPIB_DEBUG
-        Serial.println(F("LISTEN: Releasing ATN and preparing handshake lines."));
+      GPIB_SERIAL.println(F("LISTEN: Releasing ATN and preparing handshake lines."));
 #endif
-        releasePin(ATN_PIN);
-        assertPin(NRFD_PIN);
-        assertPin(NDAC_PIN);
-        eoi_was_detected = false;
-        gpibState = LISTEN_READY_FOR_DATA;
-      }
+      releasePin(ATN_PIN);
+      setDioPins(0x00); // Release the last address byte, the talker needs the DIO lines.
+      assertPin(NRFD_PIN);
+      assertPin(NDAC_PIN);
+      eoi_was_detected = false;
       break;
     // --- Phase 2: Perform the actual listening handshake ---
     case LISTEN_READY_FOR_DATA:
       releasePin(NRFD_PIN);
-      gpibState = LISTEN_WAIT_FOR_DAV;
-      break;
-    case LISTEN_WAIT_FOR_DAV:
-      if (getDAV) {
-        gpibState = LISTEN_DATA_RECEIVED;
-      }
       break;
     case LISTEN_DATA_RECEIVED:
     {
         uint8_t data = (currentPinStates & 0xff);
-        eoi_was_detected = getEOI;
+        eoi_was_detected = getEOI || (listenEos != NO_EOS && data == listenEos);
+#ifdef GPIB_DEBUG
+        debugBytes++;
+#endif
         if (receivedDataIndex < MAX_RECEIVE_LENGTH - 1) { // Check for buffer overflow
             receivedData[receivedDataIndex++] = (char)data; // Append data
             receivedData[receivedDataIndex] = '\0'; // Null-terminate the string
         }
         assertPin(NRFD_PIN);
         releasePin(NDAC_PIN);
-        gpibState = LISTEN_WAIT_FOR_DAV_RELEASE;
     }
       break;
-    case LISTEN_WAIT_FOR_DAV_RELEASE:
-      if (!getDAV) {
-        gpibState = LISTEN_FINISH_BYTE_HANDSHAKE;
-      }
-      break;
     case LISTEN_FINISH_BYTE_HANDSHAKE:
       assertPin(NDAC_PIN);
       if (eoi_was_detected) {
         gpibState = LISTEN_UNADDRESS_START_ATN;
-      } else {
-        gpibState = LISTEN_READY_FOR_DATA;
       }
       break;
     // --- Phase 3: Unaddress the talker ---
     case LISTEN_UNADDRESS_START_ATN:
-      if (talkerReady) {
 #ifdef GPIB_DEBUG
-        Serial.println(F("LISTEN: Unaddressing talker."));
+      GPIB_SERIAL.println(F("LISTEN: Unaddressing talker."));
 #endif
-        assertPin(ATN_PIN);
-        queueByte(0x5F, true); // UNT command
-        gpibState = LISTEN_UNADDRESS_WAIT_FOR_DAV;
-      }
+      assertPin(ATN_PIN);
       break;
-    case LISTEN_UNADDRESS_WAIT_FOR_DAV:
+    case LISTEN_UNADDRESS_SEND_UNT:
+      queueByte(0x5F, true); // UNT command
+      lastTalker = 255; // The talker is gone, the next *LISTEN must re-address it.
       releasePin(NRFD_PIN);  // We signal we are ready for the UNT command byte.
-      if (getDAV) { // Wait for our TalkerFSM to assert DAV.
-        gpibState = LISTEN_UNADDRESS_ACK;
-      }
       break;
-    case LISTEN_UNADDRESS_ACK:
+    case LISTEN_UNADDRESS_WAIT_FOR_DAV:
       releasePin(NDAC_PIN); // We acknowledge the UNT command byte. This un-sticks the TalkerFSM from T:3.
-      if (!getDAV) { // Wait for our TalkerFSM to see the acknowledgement and release DAV.
-        gpibState = LISTEN_UNADDRESS_WAIT_FOR_IDLE;
-      }
-      break;
-    case LISTEN_UNADDRESS_WAIT_FOR_IDLE:
-      if (talkerReady) {  // Now we wait for the TalkerFSM to fully complete its cycle and go idle.
-        gpibState = LISTEN_UNADDRESS_FINISH;
-      }
       break;
     case LISTEN_UNADDRESS_FINISH:
-      if (talkerReady) {
 #ifdef GPIB_DEBUG
-        Serial.println(F("LISTEN: Releasing ATN. Sequence complete."));
+      GPIB_SERIAL.println(F("LISTEN: Releasing ATN. Sequence complete."));
 #endif
-        resultReady = true;
-        releasePin(ATN_PIN);
-        releasePin(NRFD_PIN);
-        releasePin(NDAC_PIN);
-        gpibState = GPIB_COMPLETE;
+      releasePin(ATN_PIN);
+      releasePin(NRFD_PIN);
+      releasePin(NDAC_PIN);
+      setDioPins(0x00);
+      if (listenRemaining > 0) {
+        listenRemaining--;
+        if (!scanRunning) {
+          finishReading(true);
+        }
+      }
+      if (listenRemaining > 0) {
+        startListen(); // Take the next reading of this *LISTEN
+      } else if (scanRunning) {
+        gpibState = SCAN_REPORT;
       }
       break;
 // INIT states
     case INIT_PULSE_IFC_START:
 #ifdef GPIB_DEBUG
-      Serial.println(F("INIT: Asserting IFC."));
+      GPIB_SERIAL.println(F("INIT: Asserting IFC."));
 #endif
       assertPin(IFC_PIN);
-      ifcPulseTimestamp = millis();
-      gpibState = INIT_PULSE_IFC_WAIT;
-      break;
-    case INIT_PULSE_IFC_WAIT: // 2
-      if (millis() - ifcPulseTimestamp >= 1) {
-        gpibState = INIT_PULSE_IFC_END;
-      }
       break;
     case INIT_PULSE_IFC_END:
 #ifdef GPIB_DEBUG
-      Serial.println(F("INIT: Releasing IFC."));
+      GPIB_SERIAL.println(F("INIT: Releasing IFC."));
 #endif
       releasePin(IFC_PIN);
-      gpibState = INIT_ASSERT_REN_ATN;
       break;
     case INIT_ASSERT_REN_ATN:
 #ifdef GPIB_DEBUG
-      Serial.println(F("INIT: Asserting REN and ATN."));
+      GPIB_SERIAL.println(F("INIT: Asserting REN and ATN."));
 #endif
       assertPin(REN_PIN);
       assertPin(ATN_PIN);
-      gpibState = INIT_SEND_UNL;
       break;
     case INIT_SEND_UNL:
-      if (talkerReady) {
 #ifdef GPIB_DEBUG
-        Serial.println(F("INIT: Sending UNL (0x3F)."));
+      GPIB_SERIAL.println(F("INIT: Sending UNL (0x3F)."));
 #endif
-        queueByte(0x3F, true);
-        gpibState = INIT_SEND_UNT;
-      }
+      queueByte(0x3F, true);
       break;
     case INIT_SEND_UNT:
-      if (talkerReady) {
 #ifdef GPIB_DEBUG
-        Serial.println(F("INIT: Sending UNT (0x5F)."));
+      GPIB_SERIAL.println(F("INIT: Sending UNT (0x5F)."));
 #endif
-        queueByte(0x5F, true);
-        // CHANGE: After sending UNT, the command phase is done. Go to FINISH.
-        gpibState = INIT_FINISH;
-      }
+      queueByte(0x5F, true);
+      lastTalker = 255; // UNL and UNT cleared the bus, forget the cached addressing.
+      lastListener = 255;
       break;
     case INIT_FINISH:
-      if (talkerReady) {
 #ifdef GPIB_DEBUG
-        Serial.println(F("INIT: Releasing ATN and DIO bus. Sequence complete."));
+      GPIB_SERIAL.println(F("INIT: Releasing ATN and DIO bus. Sequence complete."));
 #endif
-        releasePin(ATN_PIN);
-        setDioPins(0x00);
-        gpibState = GPIB_COMPLETE;
-      }
+      releasePin(ATN_PIN);
+      setDioPins(0x00);
       break;
 // WRITE states
     case WRITE_SETUP_ADDRESSES:
-      if (talkerReady) {
 #ifdef GPIB_DEBUG
-        Serial.println(F("WRITE: Asserting ATN and setting addresses."));
+      GPIB_SERIAL.println(F("WRITE: Asserting ATN and setting addresses."));
 #endif
-        assertPin(ATN_PIN);
-        setTalkerListener(controllerAddress, initTargetAddress);
-        gpibState = WRITE_SEND_BODY;
-      }
+      assertPin(ATN_PIN);
+      setTalkerListener(controllerAddress, NO_SECONDARY_ADDRESS, initTargetAddress, initTargetSecondary);
       break;
     case WRITE_SEND_BODY:
-      if (talkerReady) {  // This state waits for the address commands to be sent.
+      // The address commands have been sent.
 #ifdef GPIB_DEBUG
-        Serial.println(F("WRITE: Releasing ATN and queuing string body."));
+      GPIB_SERIAL.println(F("WRITE: Releasing ATN and queuing string body."));
 #endif
-        releasePin(ATN_PIN);
-        for (uint8_t i = 0; i < strlen(writeString) - 1; i++) { // Queue all characters except for the last one.
-            queueByte((uint8_t)writeString[i]);
-        }
-        gpibState = WRITE_SEND_FINAL_CHAR;
+      releasePin(ATN_PIN);
+      for (uint8_t i = 0; i < strlen(writeString) - 1; i++) { // Queue all characters except for the last one.
+          queueByte((uint8_t)writeString[i]);
       }
       break;
     case WRITE_SEND_FINAL_CHAR:
-      if (talkerReady) {  // This state waits for the body of the string to be sent.
+      // The body of the string has been sent.
 #ifdef GPIB_DEBUG
-        Serial.println(F("WRITE: Asserting EOI and queuing final character."));
+      GPIB_SERIAL.println(F("WRITE: Asserting EOI and queuing final character."));
 #endif
-        assertPin(EOI_PIN);
-        queueByte((uint8_t)writeString[strlen(writeString) - 1]);
-        gpibState = WRITE_FINISH;
-      }
+      assertPin(EOI_PIN);
+      queueByte((uint8_t)writeString[strlen(writeString) - 1]);
       break;
     case WRITE_FINISH:
-      if (talkerReady) {  // This state waits for the final character to be sent.
+      // The final character has been sent.
 #ifdef GPIB_DEBUG
-        Serial.println(F("WRITE: Releasing EOI and DIO bus. Sequence complete."));
+      GPIB_SERIAL.println(F("WRITE: Releasing EOI and DIO bus. Sequence complete."));
 #endif
-        releasePin(EOI_PIN);
-        setDioPins(0x00);
-        gpibState = GPIB_COMPLETE;
+      releasePin(EOI_PIN);
+      setDioPins(0x00);
+      if (scanRunning) {
+        gpibState = SCAN_LISTEN;
+      }
+      break;
+// RECOVER states
+    case RECOVER_CLEAR_START:
+#ifdef GPIB_DEBUG
+      GPIB_SERIAL.println(F("RECOVER: Sending device clear."));
+#endif
+      assertPin(ATN_PIN);
+      if (initTargetAddress <= 30) {
+        queueByte(0x3F, true); // UNL
+        queueByte(0x20 | initTargetAddress, true); // MLA
+        if (initTargetSecondary != NO_SECONDARY_ADDRESS) {
+          queueByte(0x60 | initTargetSecondary, true); // MSA
+        }
+        queueByte(0x04, true); // SDC (Selected Device Clear)
+      } else {
+        queueByte(0x14, true); // DCL (Device Clear), no device selected yet
+      }
+      break;
+    case RECOVER_CLEAR_FINISH:
+      releasePin(ATN_PIN);
+      setDioPins(0x00);
+      lastTalker = 255; // The addressing no longer matches the cache
+      lastListener = 255;
+      break;
+    case RECOVER_IFC_START:
+#ifdef GPIB_DEBUG
+      GPIB_SERIAL.println(F("RECOVER: Pulsing IFC."));
+#endif
+      assertPin(IFC_PIN);
+      break;
+    case RECOVER_IFC_END:
+      releasePin(IFC_PIN);
+      lastTalker = 255; // IFC unaddressed every device
+      lastListener = 255;
+      break;
+// SCAN states
+    case SCAN_NEXT_ENTRY:
+      if (scanIndex == 0) { // Start of a row
+        // The line ending or comma after *SCAN LOOP is not a request to stop.
+        while (GPIB_SERIAL.available() > 0
+               && (GPIB_SERIAL.peek() == '\n' || GPIB_SERIAL.peek() == '\r' || GPIB_SERIAL.peek() == ',')) {
+          GPIB_SERIAL.read();
+        }
+        if (scanContinuous ? scanCycle > 0 && GPIB_SERIAL.available() > 0 : scanCyclesRemaining == 0) {
+          scanRunning = false; // Stopped by the host or out of cycles
+          initTargetAddress = scanSavedAddress;
+          initTargetSecondary = scanSavedSecondary;
+          listenEos = NO_EOS;
+          listenTimeoutMs = LISTEN_TIMEOUT_MS;
+          gpibState = GPIB_COMPLETE;
+          break;
+        }
+        if (!scanContinuous) {
+          scanCyclesRemaining--;
+        }
+        scanCycle++;
+        scanCycleStart = millis();
+        GPIB_SERIAL.print(F("SCAN "));
+        GPIB_SERIAL.print(scanCycle);
+      }
+      {
+        const ScanEntry* entry = &scanEntries[scanIndex];
+        // The addressing cache only sends the bytes that differ from the last entry.
+        initTargetAddress = entry->address;
+        initTargetSecondary = entry->secondary;
+        listenEos = entry->eos;
+        listenTimeoutMs = entry->timeoutMs;
+        gpibError = GPIB_OK;
+        scanEntryStart = millis();
+        if (entry->query[0] != '\0') {
+          strcpy(writeString, entry->query);
+          writeRetried = false;
+          gpibState = WRITE_SETUP_ADDRESSES;
+        }
+      }
+      break;
+    case SCAN_LISTEN:
+      listenRemaining = 1;
+      startListen();
+      break;
+    case SCAN_REPORT:
+      reportScanEntry();
+      if (++scanIndex >= scanEntryCount) {
+        GPIB_SERIAL.print(';');
+        GPIB_SERIAL.println(millis() - scanCycleStart);
+        scanIndex = 0;
       }
       break;
     case GPIB_COMPLETE:
+      if (scanRunning) { // A recovery ended this entry, report it and go on.
+        gpibState = SCAN_REPORT;
+        break;
+      }
 #ifdef GPIB_DEBUG
-      Serial.println(F("INFO: Command complete. Ready for next command."));
+      GPIB_SERIAL.println(F("INFO: Command complete. Ready for next command."));
+      GPIB_SERIAL.print(F("INFO: "));
+      GPIB_SERIAL.print(debugSteps);
+      GPIB_SERIAL.print(F(" FSM steps for "));
+      GPIB_SERIAL.print(debugBytes);
+      GPIB_SERIAL.println(F(" bytes."));
+      debugSteps = 0;
+      debugBytes = 0;
 #endif
-      gpibState = GPIB_IDLE;
       break;
-    case GPIB_IDLE:
+// DEVICE states
+    case DEVICE_ACCEPT_READY:
+      assertPin(NDAC_PIN); // Accept the next command or data byte
+      releasePin(NRFD_PIN);
+      break;
+    case DEVICE_ACCEPT_WAIT_DAV:
+      assertPin(NRFD_PIN);
+      deviceAcceptByte(currentPinStates & 0xff, getATN, getEOI);
+      releasePin(NDAC_PIN);
+      break;
+    case DEVICE_ACCEPT_WAIT_DAV_RELEASE:
+      assertPin(NDAC_PIN);
+      break;
+    case DEVICE_ACCEPT_END: // ATN dropped and the byte was not for us
+      releasePin(NRFD_PIN); // Not accepting, stay off the handshake
+      releasePin(NDAC_PIN);
+      break;
+    case DEVICE_TALK_PUT_BYTE:
+      if (deviceTxIndex == 0) { // Start of a message
+        if (devicePatternCount) {
+          ultoa(deviceTxMessages, deviceCountText, 10);
+          deviceTxMessage = deviceCountText;
+        } else {
+          deviceTxMessage = devicePattern;
+        }
+        deviceTxLength = strlen(deviceTxMessage);
+      }
+      setDioPins((uint8_t)deviceTxMessage[deviceTxIndex]);
+      if (deviceTxIndex == deviceTxLength - 1) {
+        assertPin(EOI_PIN); // Last byte of the message
+      }
+      break;
+    case DEVICE_TALK_WAIT_NRFD_RELEASED:
+      assertPin(DAV_PIN);
+      break;
+    case DEVICE_TALK_WAIT_NDAC_RELEASED:
+      releasePin(DAV_PIN);
+      releasePin(EOI_PIN);
+      if (++deviceTxIndex >= deviceTxLength) {
+        deviceTxIndex = 0;
+        deviceTxMessages++;
+      }
+      break;
+    case DEVICE_TALK_END: // ATN asserted or the controller unaddressed us
+      deviceEndTalk();
+      break;
+    default: // The state only waits, its row did everything
       break;
   }
+  return gpibState != previousState;
+}
+
+/**
+ * @brief Releases every line we may be driving and drops anything still queued
+ *        for the Talker FSM. REN and IFC are left alone.
+ */
+void GPIBnano::releaseBus() {
+  releasePin(ATN_PIN);
+  releasePin(EOI_PIN);
+  releasePin(DAV_PIN);
+  releasePin(NRFD_PIN);
+  releasePin(NDAC_PIN);
+  setDioPins(0x00);
+  queueHead = queueTail;
+  queueCount = 0;
+  talkerState = T_IDLE;
+}
+
+/**
+ * @brief Aborts the phase that missed its deadline and starts the cheapest
+ *        recovery that can work, escalating if that overruns as well:
+ *        release the lines and UNT (LISTEN) or readdress once (WRITE), then
+ *        SDC/DCL, then IFC. An *INIT that no listener accepted goes straight
+ *        to IFC, there is nobody to clear.
+ */
+void GPIBnano::recoverBus() {
+  GpibError error = armedPhase;
+  if (error == GPIB_ERR_WRITE_TIMEOUT && gpibState == WRITE_SEND_BODY && !writeRetried) {
+    // Stuck on the addressing, no data byte went out, so nothing needs clearing.
 #ifdef GPIB_DEBUG
-  reportPinStates(currentPinStates);
+    GPIB_SERIAL.println(F("RECOVER: Releasing lines and retrying *WRITE."));
 #endif
+    releaseBus();
+    writeRetried = true;
+    lastTalker = 255; // Send every addressing byte again
+    lastListener = 255;
+    phaseTimestamp = millis(); // The retry gets a full deadline
+    gpibState = WRITE_SETUP_ADDRESSES;
+    return;
+  }
+  gpibError = error;
+  if (!scanRunning) { // A scan reports it in the entry instead
+    reportError(error);
+  }
+  releaseBus();
+  switch (error) {
+    case GPIB_ERR_LISTEN_TIMEOUT:
+      listenRemaining = 0; // Abandon any remaining readings
+      if (!scanRunning) {
+        finishReading(false);
+      }
+      assertPin(NRFD_PIN); // We stay the acceptor for our own UNT
+      assertPin(NDAC_PIN);
+      gpibState = LISTEN_UNADDRESS_START_ATN;
+      break;
+    case GPIB_ERR_WRITE_TIMEOUT:
+    case GPIB_ERR_UNADDRESS_TIMEOUT:
+      gpibState = RECOVER_CLEAR_START;
+      break;
+    default:
+      gpibState = RECOVER_IFC_START;
+      break;
+  }
+}
+
+void GPIBnano::reportError(GpibError error) {
+  GPIB_SERIAL.print(F("ERROR "));
+  GPIB_SERIAL.print((uint8_t)error);
+  switch (error) {
+    case GPIB_ERR_INIT_TIMEOUT:
+      GPIB_SERIAL.println(F(": *INIT timed out, no listener. Sending IFC."));
+      break;
+    case GPIB_ERR_WRITE_TIMEOUT:
+      GPIB_SERIAL.println(F(": *WRITE timed out. Clearing device."));
+      break;
+    case GPIB_ERR_LISTEN_TIMEOUT:
+      GPIB_SERIAL.println(F(": *LISTEN timed out. Unaddressing."));
+      break;
+    case GPIB_ERR_UNADDRESS_TIMEOUT:
+      GPIB_SERIAL.println(F(": UNT timed out. Clearing device."));
+      break;
+    default:
+      GPIB_SERIAL.println(F(": Device clear timed out. Sending IFC."));
+      break;
+  }
+}
+
+/**
+ * @brief Handles a byte accepted in device mode. Command bytes (ATN asserted)
+ *        update our listen/talk addressing; data bytes are collected and each
+ *        message is verified against the pattern when EOI arrives. With a
+ *        secondary address our MLA/MTA only counts if our MSA follows it.
+ */
+void GPIBnano::deviceAcceptByte(uint8_t data, bool isCommand, bool isEnd) {
+  if (isCommand) {
+    uint8_t command = data & 0x7F;
+    if ((command & 0x60) == 0x60) { // MSA, ignored unless it completes our MLA/MTA
+      bool ours = (command == (0x60 | deviceSecondary));
+      if (deviceListenPending) {
+        deviceListening = ours;
+      }
+      if (deviceTalkPending) {
+        deviceTalking = ours;
+        deviceTxIndex = 0;
+      }
+      deviceListenPending = false;
+      deviceTalkPending = false;
+      return;
+    }
+    deviceListenPending = false; // Any other command ends the secondary address window
+    deviceTalkPending = false;
+    if (command == (0x20 | deviceAddress)) { // MLA
+      deviceListening = (deviceSecondary == NO_SECONDARY_ADDRESS);
+      deviceListenPending = !deviceListening;
+    } else if (command == 0x3F) { // UNL
+      deviceListening = false;
+    } else if (command == (0x40 | deviceAddress)) { // MTA
+      deviceTalking = (deviceSecondary == NO_SECONDARY_ADDRESS);
+      deviceTalkPending = !deviceTalking;
+      deviceTxIndex = 0;
+    } else if ((command & 0x60) == 0x40) { // UNT or another device's MTA
+      deviceTalking = false;
+    } else if (command == 0x14 || (command == 0x04 && deviceListening)) { // DCL, SDC
+      deviceTxIndex = 0;
+      deviceRxLength = 0;
+      deviceRxExpected = 0;
+    }
+    return;
+  }
+  if (deviceRxLength < MAX_RECEIVE_LENGTH - 1) {
+    receivedData[deviceRxLength] = (char)data;
+    receivedData[deviceRxLength + 1] = '\0';
+  }
+  deviceRxLength++;
+  if (isEnd) {
+    if (devicePatternCount) {
+      unsigned long value = strtoul(receivedData, NULL, 10);
+      if (value != deviceRxExpected) {
+        deviceRxErrors++;
+      }
+      deviceRxExpected = value + 1; // Resynchronize after a mismatch
+    } else if (deviceRxLength != strlen(devicePattern) || strcmp(receivedData, devicePattern) != 0) {
+      deviceRxErrors++;
+    }
+    deviceRxMessages++;
+    deviceRxLength = 0;
+  }
+}
+
+/**
+ * @brief Stops talking in device mode, releasing our data and handshake lines.
+ *        The current message restarts from its first byte if we are addressed again.
+ */
+void GPIBnano::deviceEndTalk() {
+  releasePin(DAV_PIN);
+  releasePin(EOI_PIN);
+  setDioPins(0x00);
+  deviceTxIndex = 0;
+  gpibState = DEVICE_IDLE;
+}
+
+void GPIBnano::reportDeviceStatus() {
+  GPIB_SERIAL.print(F("DEVICE "));
+  GPIB_SERIAL.print(deviceAddress);
+  if (deviceSecondary != NO_SECONDARY_ADDRESS) {
+    GPIB_SERIAL.print(':');
+    GPIB_SERIAL.print(deviceSecondary);
+  }
+  GPIB_SERIAL.print(F(" TX "));
+  GPIB_SERIAL.print(deviceTxMessages);
+  GPIB_SERIAL.print(F(" RX "));
+  GPIB_SERIAL.print(deviceRxMessages);
+  GPIB_SERIAL.print(F(" ERR "));
+  GPIB_SERIAL.println(deviceRxErrors);
+}
+
+/**
+ * @brief Resets the receive buffer and starts the LISTEN sequence for one reading.
+ */
+void GPIBnano::startListen() {
+  receivedData[0] = '\0'; // Clear receivedData
+  receivedDataIndex = 0;
+  gpibState = LISTEN_SETUP_ADDRESSES;
+}
+
+/**
+ * @brief Hands a completed reading to the reduction stage. Without reduction
+ *        or binary output the raw string becomes the result. Otherwise the
+ *        reading is parsed as a float and folded into the block statistics,
+ *        which are emitted every reduceBlockSize readings and when the
+ *        *LISTEN ends with a partial block.
+ * @param valid False if the reading timed out and must not be accumulated.
+ */
+void GPIBnano::finishReading(bool valid) {
+  if (reduceMode == REDUCE_NONE && !binaryOutput) {
+    // Copy it out, the next reading of a *LISTEN <count> reuses receivedData.
+    memcpy(resultBuffer, receivedData, receivedDataIndex + 1);
+    resultData = resultBuffer;
+    resultDataLength = receivedDataIndex;
+    resultIsBinary = false;
+    resultReady = true;
+    return;
+  }
+  if (valid) {
+    char* end;
+    float value = strtod(receivedData, &end);
+    if (end == receivedData) {
+      GPIB_SERIAL.println(F("ERROR: Reading is not numeric."));
+    } else {
+      reduceCount++;
+      if (reduceCount == 1) {
+        reduceMean = value;
+        reduceM2 = 0;
+        reduceMin = value;
+        reduceMax = value;
+      } else {
+        float delta = value - reduceMean;
+        reduceMean += delta / reduceCount;
+        reduceM2 += delta * (value - reduceMean);
+        if (value < reduceMin) reduceMin = value;
+        if (value > reduceMax) reduceMax = value;
+      }
+    }
+  }
+  if (reduceCount > 0 && (reduceCount >= reduceBlockSize || listenRemaining == 0)) {
+    emitReduced();
+  }
+  uint8_t valuesPerResult = reduceMode == REDUCE_STATS ? 4 : 1;
+  if (binaryValueCount > 0 && (listenRemaining == 0 || binaryValueCount + valuesPerResult > MAX_BINARY_VALUES)) {
+    emitBinaryBlock();
+  }
+}
+
+/**
+ * @brief Formats the current block into resultBuffer, either as ASCII
+ *        ("mean" or "mean,min,max,std") or as packed little-endian IEEE-754
+ *        floats in the same order, then starts a new block. Binary values are
+ *        only packed here, finishReading() sends them once the block is full.
+ */
+void GPIBnano::emitReduced() {
+  float values[4];
+  uint8_t valueCount = 1;
+  values[0] = reduceMean;
+  if (reduceMode == REDUCE_STATS) {
+    values[1] = reduceMin;
+    values[2] = reduceMax;
+    values[3] = reduceCount > 1 ? sqrt(reduceM2 / (reduceCount - 1)) : 0;
+    valueCount = 4;
+  }
+  reduceCount = 0;
+  if (binaryOutput) {
+    memcpy(resultBuffer + BINARY_HEADER_MAX + binaryValueCount * sizeof(float), values, valueCount * sizeof(float));
+    binaryValueCount += valueCount;
+    return;
+  }
+  char* out = resultBuffer;
+  for (uint8_t i = 0; i < valueCount; i++) {
+    if (i > 0) { *out++ = ','; }
+    dtostre(values[i], out, REDUCE_DIGITS, DTOSTR_UPPERCASE);
+    out += strlen(out);
+  }
+  resultData = resultBuffer;
+  resultDataLength = out - resultBuffer;
+  resultIsBinary = false;
+  resultReady = true;
+}
+
+/**
+ * @brief Sends the floats packed so far as one IEEE 488.2 definite length
+ *        block, "#14" to "#260" before them, so a host can tell it from the
+ *        text lines (errors, ASCII results) around it.
+ */
+void GPIBnano::emitBinaryBlock() {
+  uint8_t length = binaryValueCount * sizeof(float);
+  char lengthText[4];
+  ultoa(length, lengthText, 10);
+  uint8_t digits = strlen(lengthText);
+  char* header = resultBuffer + BINARY_HEADER_MAX - 2 - digits; // ends where the floats start
+  header[0] = '#';
+  header[1] = '0' + digits;
+  memcpy(header + 2, lengthText, digits);
+  resultData = header;
+  resultDataLength = 2 + digits + length;
+  resultIsBinary = true;
+  resultReady = true;
+  binaryValueCount = 0;
 }
 
 /**
@@ -417,43 +1093,43 @@ void GPIBnano::reportPinStates(uint16_t currentPinStates) {
   }
 
   // --- If we've reached this point, something has changed. Print the new state. ---
-  Serial.print(F("DIO: "));
-  Serial.print(getDIO8 ? '1' : '0'); // DIO8
-  Serial.print(getDIO7 ? '1' : '0'); // DIO7
-  Serial.print(getDIO6 ? '1' : '0'); // DIO6
-  Serial.print(getDIO5 ? '1' : '0'); // DIO5
-  Serial.print(getDIO4 ? '1' : '0'); // DIO4
-  Serial.print(getDIO3 ? '1' : '0'); // DIO3
-  Serial.print(getDIO2 ? '1' : '0'); // DIO2
-  Serial.print(getDIO1 ? '1' : '0'); // DIO1
-
-  Serial.print(F(" | HS:"));
-  Serial.print(getDAV ? F(" DAV") : F(" dav"));
-  Serial.print(getNRFD ? F(" NRFD") : F(" nrfd"));
-  Serial.print(getNDAC ? F(" NDAC") : F(" ndac"));
-
-  Serial.print(F(" | MGMT:"));
-  Serial.print(getEOI ? F(" EOI") : F(" eoi"));
-  Serial.print(getIFC ? F(" IFC") : F(" ifc"));
-  Serial.print(getATN ? F(" ATN") : F(" atn"));
-  Serial.print(getREN ? F(" REN") : F(" ren"));
-  Serial.print(getSRQ ? F(" SRQ") : F(" srq"));
+  GPIB_SERIAL.print(F("DIO: "));
+  GPIB_SERIAL.print(getDIO8 ? '1' : '0'); // DIO8
+  GPIB_SERIAL.print(getDIO7 ? '1' : '0'); // DIO7
+  GPIB_SERIAL.print(getDIO6 ? '1' : '0'); // DIO6
+  GPIB_SERIAL.print(getDIO5 ? '1' : '0'); // DIO5
+  GPIB_SERIAL.print(getDIO4 ? '1' : '0'); // DIO4
+  GPIB_SERIAL.print(getDIO3 ? '1' : '0'); // DIO3
+  GPIB_SERIAL.print(getDIO2 ? '1' : '0'); // DIO2
+  GPIB_SERIAL.print(getDIO1 ? '1' : '0'); // DIO1
+
+  GPIB_SERIAL.print(F(" | HS:"));
+  GPIB_SERIAL.print(getDAV ? F(" DAV") : F(" dav"));
+  GPIB_SERIAL.print(getNRFD ? F(" NRFD") : F(" nrfd"));
+  GPIB_SERIAL.print(getNDAC ? F(" NDAC") : F(" ndac"));
+
+  GPIB_SERIAL.print(F(" | MGMT:"));
+  GPIB_SERIAL.print(getEOI ? F(" EOI") : F(" eoi"));
+  GPIB_SERIAL.print(getIFC ? F(" IFC") : F(" ifc"));
+  GPIB_SERIAL.print(getATN ? F(" ATN") : F(" atn"));
+  GPIB_SERIAL.print(getREN ? F(" REN") : F(" ren"));
+  GPIB_SERIAL.print(getSRQ ? F(" SRQ") : F(" srq"));
 
   // Append the Talker FSM state, since it's always relevant.
-  Serial.print(F(" (T:"));
-  Serial.print(talkerState);
-  Serial.print(F(")"));
+  GPIB_SERIAL.print(F(" (T:"));
+  GPIB_SERIAL.print(talkerState);
+  GPIB_SERIAL.print(F(")"));
 
 
   if (currentSentDataLen > 0) {
-    Serial.print(F(" | SENT: "));
-    Serial.print(sentData);
+    GPIB_SERIAL.print(F(" | SENT: "));
+    GPIB_SERIAL.print(sentData);
   }
   if (currentRecvDataLen > 0) {
-    Serial.print(F(" | RECV: "));
-    Serial.print(receivedData);
+    GPIB_SERIAL.print(F(" | RECV: "));
+    GPIB_SERIAL.print(receivedData);
   }
-  Serial.println();
+  GPIB_SERIAL.println();
 
   previousPinStates = currentPinStates;
   previousGpibState = gpibState;
@@ -474,15 +1150,15 @@ void GPIBnano::queueByte(uint8_t data, bool isHex __attribute__((unused))) {
 #ifdef GPIB_DEBUG
     if (talkerState == T_IDLE && queueCount == 0) { sentData[0] = '\0'; }
     sendQueueIsHex[queueTail] = isHex;
-    Serial.print(F("CMD: Queued 0x")); 
-    if (data < 0x10) Serial.print('0');
-    Serial.println(data, HEX);
+    GPIB_SERIAL.print(F("CMD: Queued 0x")); 
+    if (data < 0x10) GPIB_SERIAL.print('0');
+    GPIB_SERIAL.println(data, HEX);
 #endif
     sendQueue[queueTail] = data;
     queueTail = (queueTail + 1) % QUEUE_SIZE;
     queueCount++;
   } else { 
-    Serial.println(F("ERR: Send queue is full!"));
+    GPIB_SERIAL.println(F("ERR: Send queue is full!"));
   }
 }
 
@@ -510,26 +1186,64 @@ void GPIBnano::setControlPins(uint8_t data) {
 
 
 uint16_t GPIBnano::readGpibPins() {
+    // One read per port, so all 16 lines are sampled together.
+    uint8_t assertedB = ~PINB; // LOW means asserted
+    uint8_t assertedC = ~PINC;
+    uint8_t assertedD = ~PIND;
+#define wasAsserted(P) bitRead(((P) <= 7) ? assertedD : (((P) <= 13) ? assertedB : assertedC), digitalPinToBit(P))
     uint16_t data = 0;
-    data |= isAsserted(DIO1_PIN) ? (1 << DIO1_BIT) : 0;
-    data |= isAsserted(DIO2_PIN) ? (1 << DIO2_BIT) : 0;
-    data |= isAsserted(DIO3_PIN) ? (1 << DIO3_BIT) : 0;
-    data |= isAsserted(DIO4_PIN) ? (1 << DIO4_BIT) : 0;
-    data |= isAsserted(DIO5_PIN) ? (1 << DIO5_BIT) : 0;
-    data |= isAsserted(DIO6_PIN) ? (1 << DIO6_BIT) : 0;
-    data |= isAsserted(DIO7_PIN) ? (1 << DIO7_BIT) : 0;
-    data |= isAsserted(DIO8_PIN) ? (1 << DIO8_BIT) : 0;
-    data |= isAsserted(DAV_PIN)  ? (1 << DAV_BIT) : 0;
-    data |= isAsserted(NRFD_PIN) ? (1 << NRFD_BIT) : 0;
-    data |= isAsserted(NDAC_PIN) ? (1 << NDAC_BIT): 0;
-    data |= isAsserted(EOI_PIN)  ? (1 << EOI_BIT): 0;
-    data |= isAsserted(IFC_PIN)  ? (1 << IFC_BIT): 0;
-    data |= isAsserted(ATN_PIN)  ? (1 << ATN_BIT): 0;
-    data |= isAsserted(REN_PIN)  ? (1 << REN_BIT): 0;
-    data |= isAsserted(SRQ_PIN)  ? (1 << SRQ_BIT): 0;
+    data |= wasAsserted(DIO1_PIN) ? (1 << DIO1_BIT) : 0;
+    data |= wasAsserted(DIO2_PIN) ? (1 << DIO2_BIT) : 0;
+    data |= wasAsserted(DIO3_PIN) ? (1 << DIO3_BIT) : 0;
+    data |= wasAsserted(DIO4_PIN) ? (1 << DIO4_BIT) : 0;
+    data |= wasAsserted(DIO5_PIN) ? (1 << DIO5_BIT) : 0;
+    data |= wasAsserted(DIO6_PIN) ? (1 << DIO6_BIT) : 0;
+    data |= wasAsserted(DIO7_PIN) ? (1 << DIO7_BIT) : 0;
+    data |= wasAsserted(DIO8_PIN) ? (1 << DIO8_BIT) : 0;
+    data |= wasAsserted(DAV_PIN)  ? (1 << DAV_BIT) : 0;
+    data |= wasAsserted(NRFD_PIN) ? (1 << NRFD_BIT) : 0;
+    data |= wasAsserted(NDAC_PIN) ? (1 << NDAC_BIT): 0;
+    data |= wasAsserted(EOI_PIN)  ? (1 << EOI_BIT): 0;
+    data |= wasAsserted(IFC_PIN)  ? (1 << IFC_BIT): 0;
+    data |= wasAsserted(ATN_PIN)  ? (1 << ATN_BIT): 0;
+    data |= wasAsserted(REN_PIN)  ? (1 << REN_BIT): 0;
+    data |= wasAsserted(SRQ_PIN)  ? (1 << SRQ_BIT): 0;
+#undef wasAsserted
     return data;
 }
 
+/**
+ * @brief Parses "<primary> [secondary]" into a device address.
+ * @note Secondary addresses may be given as 0-30 or in the 96-126 form
+ *       (0x60 | address) used by other controllers.
+ * @return false if an address is missing or out of range.
+ */
+bool GPIBnano::parseAddress(const char* arg, uint8_t* primary, uint8_t* secondary) {
+  char* end;
+  long pad = strtol(arg, &end, 10);
+  if (end == arg || pad < 1 || pad > 30) {
+    return false;
+  }
+  long sad = NO_SECONDARY_ADDRESS;
+  while (isspace(*end)) { end++; }
+  if (*end != '\0') {
+    const char* sadArg = end;
+    sad = strtol(sadArg, &end, 10);
+    if (end == sadArg || *end != '\0') {
+      return false;
+    }
+    if (sad >= 0x60) {
+      sad -= 0x60;
+    }
+    if (sad < 0 || sad > 30) {
+      return false;
+    }
+  }
+  *primary = (uint8_t)pad;
+  *secondary = (uint8_t)sad;
+  return true;
+}
+
 void GPIBnano::toUpperCase(char* str) {
     for (int i = 0; str[i]; i++) {
         str[i] = toupper(str[i]);
@@ -543,11 +1257,11 @@ void GPIBnano::executeHighLevelCommand(char* cmdLine) {
     cmdLine++; // Skip the leading '*'
     while (isspace(*cmdLine)) { cmdLine++; } // Trim leading spaces
 #ifdef GPIB_DEBUG
-    Serial.print(F("CMD EXECUTING: "));
-    Serial.println(cmdLine);
+    GPIB_SERIAL.print(F("CMD EXECUTING: "));
+    GPIB_SERIAL.println(cmdLine);
 #endif
     if (cmdLine[0] == '\0') { // Check if the command is empty after trimming
-        Serial.println(F("ERROR: Command must not be empty."));
+        GPIB_SERIAL.println(F("ERROR: Command must not be empty."));
         return;
     }
     const char* argument = ""; // Initialize to an unwritable dummy empty string
@@ -559,17 +1273,27 @@ void GPIBnano::executeHighLevelCommand(char* cmdLine) {
         }
     }
     toUpperCase(cmdLine); // Convert command to upper case
+    gpibError = GPIB_OK;
+    if (deviceMode && strcmp_P(cmdLine, PSTR("DEVICE")) != 0 && strcmp_P(cmdLine, PSTR("PATTERN")) != 0
+        && strcmp_P(cmdLine, PSTR("STATUS")) != 0) {
+        GPIB_SERIAL.println(F("ERROR: Only *DEVICE, *PATTERN and *STATUS in device mode."));
+        return;
+    }
     // Process the command
     if (strcmp_P(cmdLine, PSTR("INIT")) == 0) {
-        int addr = atoi(argument);
-        if (addr > 0 && addr <= 30) {
-            initTargetAddress = (uint8_t)addr;
+        if (parseAddress(argument, &initTargetAddress, &initTargetSecondary)) {
 #ifdef GPIB_DEBUG
             sentData[0] = '\0'; // Clear sentData
 #endif
             gpibState = INIT_PULSE_IFC_START;
         } else {
-            Serial.println(F("ERROR: Invalid GPIB address for *INIT."));
+            GPIB_SERIAL.println(F("ERROR: Invalid GPIB address for *INIT."));
+        }
+    } else if (strcmp_P(cmdLine, PSTR("ADDR")) == 0) {
+        if (initTargetAddress > 30) {
+            GPIB_SERIAL.println(F("ERROR: Must run *INIT <addr> before *ADDR."));
+        } else if (!parseAddress(argument, &initTargetAddress, &initTargetSecondary)) {
+            GPIB_SERIAL.println(F("ERROR: Invalid GPIB address for *ADDR."));
         }
     } else if (strcmp_P(cmdLine, PSTR("WRITE")) == 0) {
         if (strlen(argument) > 0) {
@@ -578,26 +1302,261 @@ void GPIBnano::executeHighLevelCommand(char* cmdLine) {
 #ifdef GPIB_DEBUG
             sentData[0] = '\0'; // Clear sentData
 #endif
+            writeRetried = false;
             gpibState = WRITE_SETUP_ADDRESSES;
         } else {
-            Serial.println(F("ERROR: *WRITE command received with no string."));
+            GPIB_SERIAL.println(F("ERROR: *WRITE command received with no string."));
         }
     } else if (strcmp_P(cmdLine, PSTR("LISTEN")) == 0) {
         if (initTargetAddress > 30) {
-            Serial.println(F("ERROR: Must run *INIT <addr> before *LISTEN."));
+            GPIB_SERIAL.println(F("ERROR: Must run *INIT <addr> before *LISTEN."));
+            return;
+        }
+        long count = reduceBlockSize; // one block by default
+        if (argument[0] != '\0') {
+            count = atol(argument);
+        }
+        if (count < 1 || count > 65535) {
+            GPIB_SERIAL.println(F("ERROR: Invalid reading count for *LISTEN."));
             return;
         }
-        receivedData[0] = '\0'; // Clear receivedData
-        receivedDataIndex = 0;
+        listenRemaining = (uint16_t)count;
+        listenEos = NO_EOS;
+        listenTimeoutMs = LISTEN_TIMEOUT_MS;
+        reduceCount = 0;
+        binaryValueCount = 0;
         resultReady = false;
-        gpibState = LISTEN_SETUP_ADDRESSES;
-        listenTimeoutTimestamp = millis();
+        startListen();
+    } else if (strcmp_P(cmdLine, PSTR("REDUCE")) == 0) {
+        const char* countArg = strchr(argument, ' ');
+        long count = countArg ? atol(countArg) : 1;
+        if (count < 1 || count > 65535) {
+            GPIB_SERIAL.println(F("ERROR: Invalid block size for *REDUCE."));
+        } else if (strcasecmp_P(argument, PSTR("NONE")) == 0) {
+            reduceMode = REDUCE_NONE;
+            reduceBlockSize = 1;
+        } else if (strncasecmp_P(argument, PSTR("AVG "), 4) == 0) {
+            reduceMode = REDUCE_AVG;
+            reduceBlockSize = (uint16_t)count;
+        } else if (strncasecmp_P(argument, PSTR("STATS "), 6) == 0) {
+            reduceMode = REDUCE_STATS;
+            reduceBlockSize = (uint16_t)count;
+        } else {
+            GPIB_SERIAL.println(F("ERROR: Usage *REDUCE NONE|AVG <n>|STATS <n>."));
+        }
+    } else if (strcmp_P(cmdLine, PSTR("FORMAT")) == 0) {
+        if (strcasecmp_P(argument, PSTR("ASCII")) == 0) {
+            binaryOutput = false;
+        } else if (strcasecmp_P(argument, PSTR("BINARY")) == 0) {
+            binaryOutput = true;
+        } else {
+            GPIB_SERIAL.println(F("ERROR: Usage *FORMAT ASCII|BINARY."));
+        }
+    } else if (strcmp_P(cmdLine, PSTR("DEVICE")) == 0) {
+        if (strcasecmp_P(argument, PSTR("OFF")) == 0) {
+            releaseBus();
+            deviceMode = false;
+            lastTalker = 255; // Another controller may have changed the addressing
+            lastListener = 255;
+            gpibState = GPIB_IDLE;
+        } else if (parseAddress(argument, &deviceAddress, &deviceSecondary)) {
+            releaseBus();
+            releasePin(REN_PIN); // Another controller owns the bus now
+            deviceListening = false;
+            deviceTalking = false;
+            deviceListenPending = false;
+            deviceTalkPending = false;
+            deviceTxIndex = 0;
+            deviceRxLength = 0;
+            deviceRxExpected = 0;
+            deviceTxMessages = 0;
+            deviceRxMessages = 0;
+            deviceRxErrors = 0;
+            deviceMode = true;
+            gpibState = DEVICE_IDLE;
+        } else {
+            GPIB_SERIAL.println(F("ERROR: Usage *DEVICE <addr> [secondary]|OFF."));
+        }
+    } else if (strcmp_P(cmdLine, PSTR("PATTERN")) == 0) {
+        if (strcasecmp_P(argument, PSTR("COUNT")) == 0) {
+            devicePatternCount = true;
+        } else if (strlen(argument) > 0) {
+            strncpy(devicePattern, argument, MAX_WRITE_STRING_LENGTH - 1);
+            devicePattern[MAX_WRITE_STRING_LENGTH - 1] = '\0'; // Ensure null-termination
+            devicePatternCount = false;
+        } else {
+            GPIB_SERIAL.println(F("ERROR: Usage *PATTERN COUNT|<string>."));
+        }
+        if (gpibState >= DEVICE_TALK_PUT_BYTE && gpibState <= DEVICE_TALK_WAIT_NDAC_RELEASED) {
+            deviceEndTalk(); // The message in flight was sized for the old pattern
+        }
+        deviceTxIndex = 0;
+        deviceRxExpected = 0;
+    } else if (strcmp_P(cmdLine, PSTR("SCAN")) == 0) {
+        executeScanCommand(argument);
+    } else if (strcmp_P(cmdLine, PSTR("STATUS")) == 0) {
+        if (deviceMode) {
+            reportDeviceStatus();
+        } else {
+            GPIB_SERIAL.println(F("ERROR: *STATUS requires device mode."));
+        }
+    } else {
+        GPIB_SERIAL.print(F("ERROR: Unknown command: "));
+        GPIB_SERIAL.println(cmdLine);
+    }
+}
+
+/**
+ * @brief Edits, stores and starts the scan list. QUERY, EOS and TMO change
+ *        the entry added last.
+ */
+void GPIBnano::executeScanCommand(const char* argument) {
+    const char* value = strchr(argument, ' ');
+    value = value ? value + 1 : "";
+    ScanEntry* last = scanEntryCount > 0 ? &scanEntries[scanEntryCount - 1] : NULL;
+    if (strncasecmp_P(argument, PSTR("ADD "), 4) == 0) {
+        if (scanEntryCount >= MAX_SCAN_ENTRIES) {
+            GPIB_SERIAL.println(F("ERROR: Scan list is full."));
+        } else {
+            ScanEntry* entry = &scanEntries[scanEntryCount];
+            if (parseAddress(value, &entry->address, &entry->secondary)) {
+                entry->eos = NO_EOS;
+                entry->timeoutMs = LISTEN_TIMEOUT_MS;
+                entry->query[0] = '\0';
+                scanEntryCount++;
+            } else {
+                GPIB_SERIAL.println(F("ERROR: Invalid GPIB address for *SCAN ADD."));
+            }
+        }
+    } else if (strncasecmp_P(argument, PSTR("QUERY "), 6) == 0 && last) {
+        strncpy(last->query, value, MAX_SCAN_QUERY_LENGTH - 1);
+        last->query[MAX_SCAN_QUERY_LENGTH - 1] = '\0'; // Ensure null-termination
+    } else if (strncasecmp_P(argument, PSTR("EOS "), 4) == 0 && last) {
+        long eos = atol(value);
+        if (strcasecmp_P(value, PSTR("NONE")) == 0) {
+            last->eos = NO_EOS;
+        } else if (isdigit(value[0]) && eos <= 255) {
+            last->eos = (uint16_t)eos;
+        } else {
+            GPIB_SERIAL.println(F("ERROR: Usage *SCAN EOS <0-255>|NONE."));
+        }
+    } else if (strncasecmp_P(argument, PSTR("TMO "), 4) == 0 && last) {
+        long timeout = atol(value);
+        if (timeout < 1 || timeout > 65535) {
+            GPIB_SERIAL.println(F("ERROR: Invalid timeout for *SCAN TMO."));
+        } else {
+            last->timeoutMs = (uint16_t)timeout;
+        }
+    } else if (strcasecmp_P(argument, PSTR("CLEAR")) == 0) {
+        scanEntryCount = 0;
+    } else if (strcasecmp_P(argument, PSTR("LIST")) == 0) {
+        for (uint8_t i = 0; i < scanEntryCount; i++) {
+            const ScanEntry* entry = &scanEntries[i];
+            GPIB_SERIAL.print(F("SCAN ENTRY "));
+            GPIB_SERIAL.print(i);
+            GPIB_SERIAL.print(' ');
+            GPIB_SERIAL.print(entry->address);
+            if (entry->secondary != NO_SECONDARY_ADDRESS) {
+                GPIB_SERIAL.print(':');
+                GPIB_SERIAL.print(entry->secondary);
+            }
+            GPIB_SERIAL.print(F(" TMO "));
+            GPIB_SERIAL.print(entry->timeoutMs);
+            GPIB_SERIAL.print(F(" EOS "));
+            if (entry->eos == NO_EOS) {
+                GPIB_SERIAL.print(F("NONE"));
+            } else {
+                GPIB_SERIAL.print(entry->eos);
+            }
+            GPIB_SERIAL.print(F(" QUERY "));
+            GPIB_SERIAL.println(entry->query);
+        }
+    } else if (strcasecmp_P(argument, PSTR("SAVE")) == 0) {
+        // The magic byte is cleared first and written last, so a save cut short
+        // by a power loss reads back as no list rather than a torn one.
+        // eeprom_update_* skips unchanged cells, the entries cost no wear if unchanged.
+        eeprom_update_byte((uint8_t*)SCAN_EEPROM_ADDRESS, 0xFF);
+        eeprom_update_byte((uint8_t*)(SCAN_EEPROM_ADDRESS + 1), sizeof(ScanEntry));
+        eeprom_update_byte((uint8_t*)(SCAN_EEPROM_ADDRESS + 2), scanEntryCount);
+        eeprom_update_block(scanEntries, (void*)(SCAN_EEPROM_ADDRESS + 3), scanEntryCount * sizeof(ScanEntry));
+        eeprom_update_byte((uint8_t*)SCAN_EEPROM_ADDRESS, SCAN_EEPROM_MAGIC);
+    } else if (strcasecmp_P(argument, PSTR("LOAD")) == 0) {
+        // A different entry size means the list was saved by a build with other
+        // MAX_SCAN_QUERY_LENGTH, its layout does not match ours.
+        uint8_t count = eeprom_read_byte((const uint8_t*)(SCAN_EEPROM_ADDRESS + 2));
+        bool valid = eeprom_read_byte((const uint8_t*)SCAN_EEPROM_ADDRESS) == SCAN_EEPROM_MAGIC
+            && eeprom_read_byte((const uint8_t*)(SCAN_EEPROM_ADDRESS + 1)) == sizeof(ScanEntry)
+            && count <= MAX_SCAN_ENTRIES;
+        for (uint8_t i = 0; valid && i < count; i++) { // Check all before replacing the list
+            ScanEntry entry;
+            eeprom_read_block(&entry, (const void*)(SCAN_EEPROM_ADDRESS + 3 + i * sizeof(ScanEntry)), sizeof(ScanEntry));
+            valid = isScanEntryValid(&entry);
+        }
+        if (!valid) {
+            GPIB_SERIAL.println(F("ERROR: No valid scan list saved."));
+        } else {
+            eeprom_read_block(scanEntries, (const void*)(SCAN_EEPROM_ADDRESS + 3), count * sizeof(ScanEntry));
+            for (uint8_t i = 0; i < count; i++) {
+                scanEntries[i].query[MAX_SCAN_QUERY_LENGTH - 1] = '\0'; // Ensure null-termination
+            }
+            scanEntryCount = count;
+        }
+    } else if (strcasecmp_P(argument, PSTR("RUN")) == 0 || strncasecmp_P(argument, PSTR("RUN "), 4) == 0
+        || strcasecmp_P(argument, PSTR("LOOP")) == 0) {
+        long cycles = value[0] != '\0' ? atol(value) : 1;
+        if (initTargetAddress > 30) {
+            GPIB_SERIAL.println(F("ERROR: Must run *INIT <addr> before *SCAN."));
+        } else if (scanEntryCount == 0) {
+            GPIB_SERIAL.println(F("ERROR: Scan list is empty."));
+        } else if (cycles < 1 || cycles > 65535) {
+            GPIB_SERIAL.println(F("ERROR: Invalid cycle count for *SCAN RUN."));
+        } else {
+            scanContinuous = (argument[0] == 'L' || argument[0] == 'l');
+            scanCyclesRemaining = (uint16_t)cycles;
+            scanSavedAddress = initTargetAddress;
+            scanSavedSecondary = initTargetSecondary;
+            scanCycle = 0;
+            scanIndex = 0;
+            scanRunning = true;
+            gpibState = SCAN_NEXT_ENTRY;
+        }
+    } else if (strcasecmp_P(argument, PSTR("STOP")) == 0) {
+        // Nothing to do, the scan stopped when this command arrived.
+    } else if (last == NULL && (strncasecmp_P(argument, PSTR("QUERY "), 6) == 0
+        || strncasecmp_P(argument, PSTR("EOS "), 4) == 0 || strncasecmp_P(argument, PSTR("TMO "), 4) == 0)) {
+        GPIB_SERIAL.println(F("ERROR: Must run *SCAN ADD <addr> first."));
     } else {
-        Serial.print(F("ERROR: Unknown command: "));
-        Serial.println(cmdLine);
+        GPIB_SERIAL.println(F("ERROR: Usage *SCAN ADD|QUERY|EOS|TMO|CLEAR|LIST|SAVE|LOAD|RUN|LOOP|STOP."));
     }
 }
 
+/**
+ * @brief Appends ";<addr>[:<sad>] <ms> <reading>" for the entry just read to
+ *        the current scan row. A failed entry shows "!<error>" as its reading.
+ */
+void GPIBnano::reportScanEntry() {
+  const ScanEntry* entry = &scanEntries[scanIndex];
+  GPIB_SERIAL.print(';');
+  GPIB_SERIAL.print(entry->address);
+  if (entry->secondary != NO_SECONDARY_ADDRESS) {
+    GPIB_SERIAL.print(':');
+    GPIB_SERIAL.print(entry->secondary);
+  }
+  GPIB_SERIAL.print(' ');
+  GPIB_SERIAL.print(millis() - scanEntryStart);
+  GPIB_SERIAL.print(' ');
+  if (gpibError != GPIB_OK) {
+    GPIB_SERIAL.print('!');
+    GPIB_SERIAL.print((uint8_t)gpibError);
+    return;
+  }
+  // Drop the instrument's line ending so the whole scan stays on one row.
+  while (receivedDataIndex > 0 && (receivedData[receivedDataIndex - 1] == '\n' || receivedData[receivedDataIndex - 1] == '\r')) {
+    receivedData[--receivedDataIndex] = '\0';
+  }
+  GPIB_SERIAL.print(receivedData);
+}
+
 /**
  * @brief Reads from the serial port until a complete line or comma is received.
  */
@@ -605,8 +1564,8 @@ void GPIBnano::handleSerialInput() {
   static char serialCommandBuffer[MAX_COMMAND_LENGTH]; // Static buffer to retain data
   static int commandIndex = 0; // Static index to retain state
 
-  while (Serial.available() > 0 && gpibState == GPIB_IDLE) {
-    char receivedChar = Serial.read();
+  while (GPIB_SERIAL.available() > 0 && gpibState >= GPIB_IDLE) { // idle, or any device mode state
+    char receivedChar = GPIB_SERIAL.read();
     
     if (receivedChar == '\n' || receivedChar == '\r' || receivedChar == ',') {
       if (commandIndex > 0) {
@@ -615,7 +1574,7 @@ void GPIBnano::handleSerialInput() {
         if (strncmp(serialCommandBuffer, "*", 1) == 0) {
           executeHighLevelCommand(serialCommandBuffer);
         } else {
-          Serial.println(F("ERROR: All commands must start with '*'."));
+          GPIB_SERIAL.println(F("ERROR: All commands must start with '*'."));
         }
         
         commandIndex = 0; // Reset the index for the next command
@@ -624,7 +1583,7 @@ void GPIBnano::handleSerialInput() {
       if (commandIndex < MAX_COMMAND_LENGTH - 1) { // Ensure there's space for the null terminator
         serialCommandBuffer[commandIndex++] = receivedChar; // Add the character to the buffer
       } else {
-        Serial.println(F("ERROR: Command too long."));
+        GPIB_SERIAL.println(F("ERROR: Command too long."));
         commandIndex = 0; // Reset the index if the command is too long
       }
     }
@@ -636,8 +1595,8 @@ void GPIBnano::begin(uint8_t ctrlAddress) {
   setDioPins(0x00);
   setControlPins(0x00);
 #ifdef GPIB_DEBUG
-  Serial.println(F("\n--- GPIB Low-Level Protocol Driver ---"));
-  Serial.println(F("Ready for commands (e.g., *INIT 22)."));
-  Serial.println(F("------------------------------------------------------------------"));
+  GPIB_SERIAL.println(F("\n--- GPIB Low-Level Protocol Driver ---"));
+  GPIB_SERIAL.println(F("Ready for commands (e.g., *INIT 22)."));
+  GPIB_SERIAL.println(F("------------------------------------------------------------------"));
 #endif
 }
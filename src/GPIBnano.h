@@ -2,6 +2,18 @@
 #define GPIBNano_H
 #include <Arduino.h> // Include Arduino core library for types
 
+// --- Serial Backend ---
+// Uncomment to replace HardwareSerial with the interrupt driven FastSerial
+// backend (500000-2000000 baud, larger rings, optional RTS/CTS, see FastSerial.h).
+// Both cannot be linked at once, so the sketch must use GPIB_SERIAL, not Serial.
+//#define GPIB_FAST_SERIAL
+#ifdef GPIB_FAST_SERIAL
+#include "FastSerial.h"
+#define GPIB_SERIAL fastSerial
+#else
+#define GPIB_SERIAL Serial
+#endif
+
 // --- Pin Bitmasks & Argument Macros ---
 // These defines are sorted by GPIB function. They provide the arguments for
 
@@ -94,20 +106,65 @@ Assert/Release nomenclature to avoid confusion.
 #define getSRQ  (currentPinStates & (1 << SRQ_BIT))
 
 
-#define LISTEN_TIMEOUT_MS 3000
+// --- Per-phase deadlines, a phase that overruns is aborted and the bus recovered ---
+#define LISTEN_TIMEOUT_MS 3000 // instrument addressed to talk until EOI
+#define INIT_TIMEOUT_MS 100 // IFC pulse and UNL/UNT
+#define WRITE_TIMEOUT_MS 1000 // addressing and the whole *WRITE string
+#define UNADDRESS_TIMEOUT_MS 100 // UNT after a *LISTEN
+#define CLEAR_TIMEOUT_MS 100 // recovery device clear (SDC/DCL)
+#define ATN_SETTLE_US 100 // time for software acceptors (e.g. device mode) to notice ATN
+#define IFC_PULSE_US 1000 // IFC assertion time, IEEE-488 needs at least 100us
+#define MAX_FSM_STEPS 16 // FSM steps per processGPIB() before returning to the sketch
+#define NO_SECONDARY_ADDRESS 255 // device uses primary addressing only
 // note, we use conservative buffer sizes because they are static in RAM.
 // some applications may need larger buffers.
 #define MAX_COMMAND_LENGTH 32 // Define a maximum command length
 #define MAX_WRITE_STRING_LENGTH (MAX_COMMAND_LENGTH - strlen("*WRITE ")) //max parameter for *WRITE command
 #define MAX_RECEIVE_LENGTH 32 // length of receive buffer for *LISTEN
 #define QUEUE_SIZE MAX_WRITE_STRING_LENGTH // --- Send Queue (FIFO) ---
+#define MAX_RESULT_LENGTH 64 // raw reading (<= MAX_RECEIVE_LENGTH), "mean,min,max,std" or a block of packed floats
+#define BINARY_HEADER_MAX 4 // "#260", the longest block header that fits in MAX_RESULT_LENGTH
+#define MAX_BINARY_VALUES ((MAX_RESULT_LENGTH - BINARY_HEADER_MAX) / sizeof(float)) // floats per binary block
+#define REDUCE_DIGITS 6 // digits after the decimal point for ASCII reduced results
+#define MAX_SCAN_ENTRIES 6 // instruments in the *SCAN list
+#define MAX_SCAN_QUERY_LENGTH (MAX_COMMAND_LENGTH - strlen("*SCAN QUERY ")) // max query per *SCAN entry
+#define NO_EOS 0xFFFF // a reading ends on EOI only
+#define SCAN_EEPROM_ADDRESS 0 // where *SCAN SAVE keeps the list: magic, entry size, count, entries
+#define SCAN_EEPROM_MAGIC 0x5C // marks a complete saved list, written last
+
+// --- Reading reduction (*REDUCE) ---
+enum ReduceMode {
+  REDUCE_NONE,  // every reading is passed through as received
+  REDUCE_AVG,   // one block average per N readings
+  REDUCE_STATS  // mean, min, max and standard deviation per N readings
+};
+
+// --- Scan list (*SCAN) ---
+struct ScanEntry {
+  uint8_t address;
+  uint8_t secondary; // NO_SECONDARY_ADDRESS for primary addressing
+  uint16_t eos; // byte that also ends the reading, or NO_EOS
+  uint16_t timeoutMs; // deadline of the reading, replaces LISTEN_TIMEOUT_MS
+  char query[MAX_SCAN_QUERY_LENGTH]; // written before the reading, empty to only listen
+};
 
 // --- State Machine Definitions ---
 enum TalkerState {
   T_IDLE,
   T_WAIT_NDAC_ASSERTED,
   T_WAIT_NRFD_RELEASED,
-  T_WAIT_NDAC_RELEASED
+  T_WAIT_NDAC_RELEASED,
+  T_STATE_COUNT // number of states, not a state
+};
+
+// Reported as "ERROR <n>: ..." and by error(). Values are part of the serial protocol.
+enum GpibError {
+  GPIB_OK, // 0
+  GPIB_ERR_INIT_TIMEOUT, // 1 no listener accepted UNL/UNT
+  GPIB_ERR_WRITE_TIMEOUT, // 2 the device did not accept the *WRITE string
+  GPIB_ERR_LISTEN_TIMEOUT, // 3 the device did not finish talking
+  GPIB_ERR_UNADDRESS_TIMEOUT, // 4 UNT after *LISTEN was not accepted
+  GPIB_ERR_CLEAR_TIMEOUT // 5 device clear failed, IFC was sent
 };
 
 enum GpibState {
@@ -123,38 +180,68 @@ enum GpibState {
   LISTEN_FINISH_BYTE_HANDSHAKE, // 6
   // Phase 3: Unaddress the talker to clean up the bus
   LISTEN_UNADDRESS_START_ATN, // 7
+  LISTEN_UNADDRESS_SEND_UNT, // 8
   // New states for the self-handshake to prevent deadlock
-  LISTEN_UNADDRESS_WAIT_FOR_DAV, // 8
-  LISTEN_UNADDRESS_ACK, // 9
-  LISTEN_UNADDRESS_WAIT_FOR_IDLE, // 10
-  LISTEN_UNADDRESS_FINISH, // 11
+  LISTEN_UNADDRESS_WAIT_FOR_DAV, // 9
+  LISTEN_UNADDRESS_ACK, // 10
+  LISTEN_UNADDRESS_WAIT_FOR_IDLE, // 11
+  LISTEN_UNADDRESS_FINISH, // 12
 // WRITE states
-  WRITE_SETUP_ADDRESSES, // 12
-  WRITE_SEND_BODY, // 13
-  WRITE_SEND_FINAL_CHAR, // 14
-  WRITE_FINISH, // 15
+  WRITE_SETUP_ADDRESSES, // 13
+  WRITE_SEND_BODY, // 14
+  WRITE_SEND_FINAL_CHAR, // 15
+  WRITE_FINISH, // 16
 // INIT states
-  INIT_PULSE_IFC_START, // 16
-  INIT_PULSE_IFC_WAIT, // 17
-  INIT_PULSE_IFC_END, // 18
-  INIT_ASSERT_REN_ATN, // 19
-  INIT_SEND_UNL, // 20
-  INIT_SEND_UNT, // 21
-  INIT_FINISH, // 22
-  GPIB_COMPLETE, // 23
-  GPIB_IDLE // 24
+  INIT_PULSE_IFC_START, // 17
+  INIT_PULSE_IFC_WAIT, // 18
+  INIT_PULSE_IFC_END, // 19
+  INIT_ASSERT_REN_ATN, // 20
+  INIT_SEND_UNL, // 21
+  INIT_SEND_UNT, // 22
+  INIT_FINISH, // 23
+// RECOVER states, entered when a phase misses its deadline
+  RECOVER_CLEAR_START, // 24
+  RECOVER_CLEAR_FINISH, // 25
+  RECOVER_IFC_START, // 26
+  RECOVER_IFC_END, // 27
+// SCAN states, each entry reuses the WRITE and LISTEN states
+  SCAN_NEXT_ENTRY, // 28
+  SCAN_LISTEN, // 29
+  SCAN_REPORT, // 30
+  GPIB_COMPLETE, // 31
+  GPIB_IDLE, // 32
+// DEVICE states (device mode only, must come after GPIB_IDLE)
+  DEVICE_IDLE, // 33
+  DEVICE_ACCEPT_READY, // 34
+  DEVICE_ACCEPT_WAIT_DAV, // 35
+  DEVICE_ACCEPT_WAIT_DAV_RELEASE, // 36
+  DEVICE_ACCEPT_END, // 37
+  DEVICE_TALK_PUT_BYTE, // 38
+  DEVICE_TALK_WAIT_NRFD_RELEASED, // 39
+  DEVICE_TALK_WAIT_NDAC_RELEASED, // 40
+  DEVICE_TALK_END, // 41
+  GPIB_STATE_COUNT // number of states, not a state
 };
 
+struct StateRow; // what a state waits for and where it goes, see stateTable in GPIBnano.cpp
+
 class GPIBnano {
 public:
     void begin(uint8_t ctrlAddress = 0);
     void processGPIB();
     bool isResult();
     const char* result();
+    uint8_t resultLength();
+    bool isBinaryResult();
+    GpibError error();
 private:
-    void updateTalkerFSM(uint16_t currentPinStates);
-    void gpibFSM(uint16_t currentPinStates);
-    void setTalkerListener(uint8_t talkerAddress, uint8_t listenerAddress);
+    bool updateTalkerFSM(uint16_t currentPinStates);
+    bool gpibFSM(uint16_t currentPinStates);
+    uint8_t readInputFlags(uint16_t currentPinStates);
+    bool isRowReady(const StateRow* tableRow, uint16_t currentPinStates, uint8_t inputFlags);
+    void setTalkerListener(uint8_t talkerAddress, uint8_t talkerSecondary,
+                           uint8_t listenerAddress, uint8_t listenerSecondary);
+    bool parseAddress(const char* arg, uint8_t* primary, uint8_t* secondary);
     void toUpperCase(char* str);
     void executeHighLevelCommand(char* cmdLine);
     void reportPinStates(uint16_t currentPinStates);
@@ -163,6 +250,18 @@ private:
     void setDioPins(uint8_t data);
     void setControlPins(uint8_t data);
     void handleSerialInput();
+    void recoverBus();
+    void releaseBus();
+    void reportError(GpibError error);
+    void startListen();
+    void deviceAcceptByte(uint8_t data, bool isCommand, bool isEnd);
+    void deviceEndTalk();
+    void reportDeviceStatus();
+    void finishReading(bool valid);
+    void emitReduced();
+    void emitBinaryBlock();
+    void executeScanCommand(const char* argument);
+    void reportScanEntry();
     };
 
 extern GPIBnano gpibNano;